@@ -65,7 +65,16 @@
 #pragma DATA _EEPROM, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
 	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
 	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff
 
 // PIC18F4520 config fuses
 //#pragma DATA 	_CONFIG1H, 0x08  // internal osc, RA6,7 IO
@@ -113,6 +122,7 @@ void main(void) {
 	txsta.SYNC = 0;  // async mode
 	rcsta.SPEN = 1;  // serial port enable
 	pie1.RCIE = 0;  // no interrupts
+	pie1.TXIE = 0;  // enabled when there is data to send
 	rcsta.RX9 = 0;  // 8 bit reception
 	txsta.TX9 = 0;  // 8 bit transmit
 	rcsta.CREN = 1;  // enable receiver
@@ -123,6 +133,9 @@ void main(void) {
 	tmr1h = 0xff;
 	tmr1l = 0x00;
 
+	// timer 3 - free running receive timestamp timer - 1us per count
+	t3con = 0xb1;  // 16 bit reads
+
 	// set up modules
 	ioctl_init();
 	midi_init();
@@ -144,7 +157,6 @@ void main(void) {
 
 	while(1) {
 		clear_wdt();
-		midi_tx_task();
 		midi_rx_task();
 	 	// timer 1 task timer - 256us interval
 		if(pir1.TMR1IF) {
@@ -157,9 +169,15 @@ void main(void) {
 			if(task_div == 0x01) {
 				setup_timer_task();
 			}
+			else if(task_div == 0x04) {
+				event_timer_task();
+			}
 			else if(task_div == 0x08) {
 				config_store_timer_task();
 			}
+			else if(task_div == 0x0c) {
+				midi_timer_task();
+			}
 			else if(task_div == 0x0f) {
 				voice_timer_task();
 				task_div = 0;
@@ -170,6 +188,9 @@ void main(void) {
 
 // interrupt
 void interrupt(void) {
+	unsigned char rx_byte;
+	unsigned int rx_time;
+
 	// MIDI input for blinking the out/thru LED
 	if(intcon.INT0IF) {
 		intcon.INT0IF = 0;
@@ -178,12 +199,25 @@ void interrupt(void) {
 
 	// MIDI receive
 	if(pir1.RCIF) {
-		midi_rx_byte(rcreg);
+		// timestamp the byte - reading TMR3L latches TMR3H
+		rx_time = tmr3l;
+		rx_time |= ((unsigned int)tmr3h << 8);
+		// framing error belongs to the byte we are about to read
+		if(rcsta.FERR) midi_rx_error(MIDI_RX_STAT_FRAMING);
+		rx_byte = rcreg;
+		// act on realtime bytes right away - they are still queued for echo
+		if(rx_byte >= MIDI_TIMING_TICK) event_rx_realtime(rx_byte);
+		midi_rx_byte(rx_byte, rx_time);
 		// clear errors
 		if(rcsta.FERR || rcsta.OERR) {
+			if(rcsta.OERR) midi_rx_error(MIDI_RX_STAT_OVERRUN);
 			rcsta.CREN = 0;
 			rcsta.CREN = 1;
 		}
 	}
-}
 
+	// MIDI transmit - keep the holding register full
+	if(pie1.TXIE && pir1.TXIF) {
+		midi_tx_isr();
+	}
+}
@@ -0,0 +1,99 @@
+/*
+ * K1600 MIDI Converter - CC pair check
+ *
+ * Host build of event.c - feeds 14 bit CC pairs to a CC mapped CV and
+ * checks that each pair makes one DAC write with the right value. The
+ * rest of the firmware is stubbed out. Build with bench/run.sh.
+ */
+#include <stdio.h>
+#include "system.h"
+
+struct sfr_bits intcon, pir1, pie1, txsta;
+volatile unsigned char txreg, tmr3l, tmr3h;
+
+void event_init(void);
+void event_timer_task(void);
+void event_set_cv(unsigned char num, unsigned char map, unsigned char chan, unsigned char val);
+void _midi_rx_control_change(unsigned char channel, unsigned char controller, 
+	unsigned char value);
+
+// CV writes seen
+unsigned int cv_writes;
+unsigned int cv_last;
+void ioctl_set_cv_out(unsigned char num, unsigned int val) {
+	if(num) return;
+	cv_writes ++;
+	cv_last = val;
+}
+
+// everything else does nothing
+#define STUB(n) void n() { }
+STUB(_midi_tx_channel_pressure) STUB(_midi_tx_control_change)
+STUB(_midi_tx_key_pressure) STUB(_midi_tx_note_off) STUB(_midi_tx_note_on)
+STUB(_midi_tx_pitch_bend) STUB(_midi_tx_program_change)
+STUB(_midi_tx_song_position) STUB(_midi_tx_song_select)
+STUB(_midi_tx_system_reset) STUB(config_store_set_val)
+STUB(ioctl_isr_pulse_clock) STUB(ioctl_isr_pulse_reset)
+STUB(ioctl_set_clock_led) STUB(ioctl_set_clock_out) STUB(ioctl_set_cv_led)
+STUB(ioctl_set_cv_exact) STUB(ioctl_set_cv_slew) STUB(ioctl_set_frame)
+STUB(ioctl_set_gate_led) STUB(ioctl_set_gate_out) STUB(ioctl_set_midi_in_led)
+STUB(ioctl_set_output_delay) STUB(ioctl_set_reset_led)
+STUB(ioctl_set_reset_out) STUB(ioctl_set_trig_led) STUB(ioctl_set_trig_out)
+STUB(midi_set_thru_filter) STUB(midi_set_thru_mode) STUB(setup_mode_cancel)
+STUB(sysex_rx_data) STUB(sysex_rx_end) STUB(sysex_rx_start)
+STUB(voice_damper) STUB(voice_note_off) STUB(voice_note_on)
+STUB(voice_pitch_bend) STUB(voice_set_legato_retrig) STUB(voice_set_mode)
+STUB(voice_set_pitch_bend_range) STUB(voice_set_unit) STUB(voice_state_reset)
+unsigned char config_store_get_val() { return 0; }
+unsigned char midi_get_thru_mode() { return 0; }
+unsigned char midi_thru_echo() { return 0; }
+unsigned char setup_get_mode() { return 0; }
+
+int fails;
+
+// check the writes since the last check
+void check(const char *name, unsigned int writes, unsigned int msb, 
+		unsigned int lsb) {
+	unsigned int want = 4095 - ((msb << 7 | lsb) >> 2);
+	int bad = cv_writes != writes || (writes && cv_last != want);
+	if(bad) fails ++;
+	printf("%-16s want %u write(s) of %4u  got %u of %4u  %s\n", name, writes, 
+		want, cv_writes, cv_last, bad ? "FAIL" : "ok");
+	cv_writes = 0;
+}
+
+int main(void) {
+	unsigned char i;
+	event_init();
+	event_set_cv(0, 2, 0, 1);  // CV1 - CC mapping - channel 1 - CC 1 / 33
+	cv_writes = 0;
+	// a 7 bit source goes straight out
+	_midi_rx_control_change(0, 1, 10);
+	check("7 bit", 1, 10, 0);
+	// the first LSB - from here on MSBs are held for their LSB
+	_midi_rx_control_change(0, 33, 127);
+	check("first LSB", 1, 10, 127);
+	// MSB boundary - 10/127 to 11/0 with no write of 11/127 or 10/0
+	_midi_rx_control_change(0, 1, 11);
+	_midi_rx_control_change(0, 33, 0);
+	check("MSB up", 1, 11, 0);
+	_midi_rx_control_change(0, 1, 10);
+	_midi_rx_control_change(0, 33, 127);
+	check("MSB down", 1, 10, 127);
+	// an LSB on its own refines the last MSB
+	_midi_rx_control_change(0, 33, 64);
+	check("LSB only", 1, 10, 64);
+	// a held MSB is written when the next MSB comes first
+	_midi_rx_control_change(0, 1, 20);
+	check("MSB held", 0, 0, 0);
+	_midi_rx_control_change(0, 1, 21);
+	check("next MSB", 1, 20, 0);
+	// or when no LSB comes in time
+	for(i = 0; i < 3; i ++) event_timer_task();
+	check("no LSB", 1, 21, 0);
+	// a new mapping starts out as a 7 bit source again
+	event_set_cv(0, 2, 0, 1);
+	_midi_rx_control_change(0, 1, 30);
+	check("remapped", 1, 30, 0);
+	return fails;
+}
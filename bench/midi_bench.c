@@ -0,0 +1,131 @@
+/*
+ * K1600 MIDI Converter - MIDI receive benchmark
+ *
+ * Host build of midi.c - feeds byte streams through the receiver and
+ * reports the x86 instructions executed per byte. The counts come from
+ * single stepping the run under ptrace, so they are the same every time
+ * and do not depend on what else the host is doing. Build with
+ * bench/run.sh. -DBASELINE builds against the original byte ring
+ * parser, which takes no timestamp.
+ */
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include "system.h"
+
+struct sfr_bits intcon, pir1, pie1, txsta;
+volatile unsigned char txreg, tmr3l, tmr3h;
+volatile unsigned long hits;
+
+void midi_init(void);
+void midi_rx_task(void);
+#ifdef BASELINE
+void midi_rx_byte(unsigned char rx_byte);
+#define RX_BYTE(b) midi_rx_byte(b)
+#else
+void midi_rx_byte(unsigned char rx_byte, unsigned int time);
+#define RX_BYTE(b) midi_rx_byte(b, 0)
+#endif
+
+// callbacks - count them so nothing is optimised away
+#define CB(n, ...) void n(__VA_ARGS__) { hits ++; }
+CB(_midi_learn_channel, unsigned char a)
+CB(_midi_setup_note_on, unsigned char a, unsigned char b, unsigned char c)
+CB(_midi_setup_control_change, unsigned char a, unsigned char b, unsigned char c)
+CB(_midi_setup_pitch_bend, unsigned char a, unsigned int b)
+CB(_midi_rx_note_off, unsigned char a, unsigned char b)
+CB(_midi_rx_note_on, unsigned char a, unsigned char b, unsigned char c)
+CB(_midi_rx_key_pressure, unsigned char a, unsigned char b, unsigned char c)
+CB(_midi_rx_control_change, unsigned char a, unsigned char b, unsigned char c)
+CB(_midi_rx_program_change, unsigned char a, unsigned char b)
+CB(_midi_rx_channel_pressure, unsigned char a, unsigned char b)
+CB(_midi_rx_pitch_bend, unsigned char a, unsigned int b)
+CB(_midi_rx_song_position, unsigned int a)
+CB(_midi_isr_song_position, unsigned int a)
+CB(_midi_rx_song_select, unsigned char a)
+CB(_midi_rx_sysex_start, void)
+CB(_midi_rx_sysex_data, unsigned char a)
+CB(_midi_rx_sysex_end, void)
+CB(_midi_rx_timing_tick, void)
+CB(_midi_rx_start_song, void)
+CB(_midi_rx_continue_song, void)
+CB(_midi_rx_stop_song, void)
+CB(_midi_rx_active_sensing, void)
+CB(_midi_rx_system_reset, void)
+
+// mixed - notes with running status, CCs, bend, program, pressure, clock,
+// active sensing, a short sysex and song position
+static const unsigned char mixed[] = {
+	0x90, 60, 100, 62, 100, 0x80, 60, 0, 0xb3, 7, 90, 1, 64, 0xf8,
+	0xe0, 0, 64, 0xc2, 5, 0xd1, 30, 0x99, 36, 127, 0xfe, 0x89, 36, 0,
+	0xf0, 0, 1, 0x72, 0x40, 3, 1, 0xf7, 0xa0, 60, 20, 0xf2, 0, 1, 0xf8,
+	0x90, 64, 80, 0x90, 64, 0
+};
+
+// dense - notes and CCs on several channels with no running status
+static const unsigned char dense[] = {
+	0x90, 60, 100, 0xb0, 1, 20, 0x91, 48, 90, 0xb1, 74, 64,
+	0x80, 60, 0, 0xb0, 1, 21, 0x81, 48, 0, 0xb1, 74, 65
+};
+
+// status - messages that sat at the end of the old status tests
+static const unsigned char status[] = {
+	0xe0, 0, 64, 0xd0, 30, 0xf3, 2, 0xf2, 0, 1, 0xe1, 0, 65, 0xd1, 31
+};
+
+#define PASSES 20  // times each stream is fed through
+
+// feed a stream through the receiver between two markers for the counter
+void run(const unsigned char *stream, unsigned char len) {
+	unsigned char i, j;
+	midi_init();
+	raise(SIGUSR1);
+	for(i = 0; i < PASSES; i ++) {
+		for(j = 0; j < len; j ++) {
+			RX_BYTE(stream[j]);
+			midi_rx_task();
+		}
+	}
+	raise(SIGUSR2);
+}
+
+int main(void) {
+	static const char *name[4] = {"empty", "mixed", "dense", "status"};
+	static const unsigned char len[4] = {0, sizeof(mixed), sizeof(dense), 
+		sizeof(status)};
+	unsigned long count[4], steps;
+	int pid, st, sig, n;
+	txsta.TRMT = 1;
+	pid = fork();
+	if(pid == 0) {
+		ptrace(PTRACE_TRACEME, 0, 0, 0);
+		raise(SIGSTOP);
+		run(mixed, 0);  // marker overhead
+		run(mixed, sizeof(mixed));
+		run(dense, sizeof(dense));
+		run(status, sizeof(status));
+		_exit(0);
+	}
+	// step the child one instruction at a time - count between the markers
+	waitpid(pid, &st, 0);
+	n = 0;
+	steps = 0;
+	sig = 0;
+	while(1) {
+		ptrace(PTRACE_SINGLESTEP, pid, 0, sig);
+		waitpid(pid, &st, 0);
+		if(WIFEXITED(st)) break;
+		sig = 0;
+		steps ++;
+		if(WSTOPSIG(st) == SIGUSR1) steps = 0;
+		else if(WSTOPSIG(st) == SIGUSR2 && n < 4) count[n ++] = steps;
+	}
+	for(st = 1; st < 4; st ++) {
+		printf("  %s %5.1f", name[st], 
+			(double)(count[st] - count[0]) / (PASSES * len[st]));
+	}
+	printf("  x86 instructions/byte\n");
+	return 0;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# K1600 MIDI Converter - build and run the MIDI receive benchmark on the host
+#
+# usage: bench/run.sh [baseline commit]
+# compares midi.c in the tree with midi.c from the baseline commit
+# (default: the first commit), then runs the receive order and CC pair
+# checks on the tree. Needs gcc on x86 Linux and git.
+set -e
+top=$(cd "$(dirname "$0")/.." && pwd)
+base=${1:-$(git -C "$top" rev-list --max-parents=0 HEAD)}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+mkdir "$work/new" "$work/old"
+for f in midi.c midi.h midi_callbacks.h; do
+	tr -d '\r' < "$top/$f" > "$work/new/$f"
+	git -C "$top" show "$base:$f" | tr -d '\r' > "$work/old/$f"
+done
+# BoostC rom tables are pointers with an initializer list - make them arrays
+sed -i 's/^rom unsigned char \*\([a-z_]*\) = {/const unsigned char \1[] = {/' \
+	"$work/new/midi.c" "$work/old/midi.c"
+# the original parser has no receive timestamp
+old_def=-DBASELINE
+grep -q "midi_rx_byte(.*time)" "$work/old/midi.h" && old_def=-DTIMESTAMP
+for opt in O0 O2; do
+	gcc -$opt -w -I"$top/bench" -I"$work/old" $old_def -o "$work/old_$opt" \
+		"$top/bench/midi_bench.c" "$work/old/midi.c"
+	gcc -$opt -w -I"$top/bench" -I"$work/new" -o "$work/new_$opt" \
+		"$top/bench/midi_bench.c" "$work/new/midi.c"
+	echo "-$opt base $("$work/old_$opt")"
+	echo "-$opt tree $("$work/new_$opt")"
+done
+gcc -w -I"$top/bench" -I"$work/new" -o "$work/order" \
+	"$top/bench/rx_order.c" "$work/new/midi.c"
+"$work/order"
+for f in event.c event.h ioctl.h setup.h voice.h config_store.h sysex.h; do
+	tr -d '\r' < "$top/$f" > "$work/new/$f"
+done
+gcc -w -I"$top/bench" -I"$work/new" -o "$work/cc_pair" \
+	"$top/bench/cc_pair.c" "$work/new/event.c"
+"$work/cc_pair"
@@ -0,0 +1,86 @@
+/*
+ * K1600 MIDI Converter - MIDI receive order check
+ *
+ * Host build of midi.c - feeds messages through the receiver and checks
+ * the order the callbacks come out in. Build with bench/run.sh.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "system.h"
+
+struct sfr_bits intcon, pir1, pie1, txsta;
+volatile unsigned char txreg, tmr3l, tmr3h;
+
+void midi_init(void);
+void midi_rx_task(void);
+void midi_rx_byte(unsigned char rx_byte, unsigned int time);
+
+// the callbacks that are checked are logged as one letter each
+char order[32];
+unsigned char order_len;
+#define LOG(c) if(order_len < sizeof(order) - 1) order[order_len ++] = c
+
+#define CB(n, ...) void n(__VA_ARGS__) { }
+CB(_midi_learn_channel, unsigned char a)
+CB(_midi_setup_note_on, unsigned char a, unsigned char b, unsigned char c)
+CB(_midi_setup_control_change, unsigned char a, unsigned char b, unsigned char c)
+CB(_midi_setup_pitch_bend, unsigned char a, unsigned int b)
+void _midi_rx_note_off(unsigned char a, unsigned char b) { LOG('f'); }
+void _midi_rx_note_on(unsigned char a, unsigned char b, unsigned char c) { LOG('n'); }
+CB(_midi_rx_key_pressure, unsigned char a, unsigned char b, unsigned char c)
+void _midi_rx_control_change(unsigned char a, unsigned char b, unsigned char c) { LOG('c'); }
+void _midi_rx_program_change(unsigned char a, unsigned char b) { LOG('p'); }
+CB(_midi_rx_channel_pressure, unsigned char a, unsigned char b)
+CB(_midi_rx_pitch_bend, unsigned char a, unsigned int b)
+CB(_midi_rx_song_position, unsigned int a)
+CB(_midi_isr_song_position, unsigned int a)
+CB(_midi_rx_song_select, unsigned char a)
+CB(_midi_rx_sysex_start, void)
+CB(_midi_rx_sysex_data, unsigned char a)
+CB(_midi_rx_sysex_end, void)
+CB(_midi_rx_timing_tick, void)
+CB(_midi_rx_start_song, void)
+CB(_midi_rx_continue_song, void)
+CB(_midi_rx_stop_song, void)
+CB(_midi_rx_active_sensing, void)
+void _midi_rx_system_reset(void) { LOG('r'); }
+
+int fails;
+
+// feed a stream in one go - as if the task was held up - then drain it
+void check(const char *name, const unsigned char *stream, unsigned char len,
+		const char *want) {
+	unsigned char i;
+	midi_init();
+	order_len = 0;
+	for(i = 0; i < len; i ++) midi_rx_byte(stream[i], 0);
+	for(i = 0; i < 4; i ++) midi_rx_task();
+	order[order_len] = 0;
+	if(strcmp(order, want)) fails ++;
+	printf("%-14s want %-8s got %-8s %s\n", name, want, order, 
+		strcmp(order, want) ? "FAIL" : "ok");
+}
+
+// program and CC hold up channel 1 in the low lane - the note on follows them
+// and the reset must not get ahead of it, nor the note on channel 2 after it
+static const unsigned char reset_backlog[] = {
+	0xc0, 5, 0xb0, 7, 90, 0x90, 60, 100, 0xff, 0x91, 62, 100
+};
+
+// nothing waiting in the low lane - the reset goes straight through
+static const unsigned char reset_idle[] = {
+	0x90, 60, 100, 0xff, 0x90, 62, 100
+};
+
+// notes on other channels still get ahead of a backlog
+static const unsigned char note_ahead[] = {
+	0xc0, 5, 0xb0, 7, 90, 0x91, 62, 100
+};
+
+int main(void) {
+	txsta.TRMT = 1;
+	check("reset_backlog", reset_backlog, sizeof(reset_backlog), "pcnrn");
+	check("reset_idle", reset_idle, sizeof(reset_idle), "nrn");
+	check("note_ahead", note_ahead, sizeof(note_ahead), "npc");
+	return fails;
+}
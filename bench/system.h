@@ -0,0 +1,15 @@
+/*
+ * K1600 MIDI Converter - host stand-in for the BoostC system header
+ *
+ * Just enough of the PIC18F4520 registers for midi.c to build on a PC.
+ */
+struct sfr_bits {
+	unsigned GIE:1;
+	unsigned TMR1IF:1;
+	unsigned TXIE:1;
+	unsigned TXIF:1;
+	unsigned TRMT:1;
+};
+extern struct sfr_bits intcon, pir1, pie1, txsta;
+extern volatile unsigned char txreg, tmr3l, tmr3h;
+#define rom const
@@ -51,13 +51,13 @@ void config_store_timer_task(void) {
 
 // gets a config byte
 unsigned char config_store_get_val(unsigned char addr) {
-	if(addr > 0x3f) return 0;
+	if(addr >= CONFIG_MAX) return 0;
 	return config[addr];
 }
 
 // sets a config byte
 void config_store_set_val(unsigned char addr, unsigned char val) {
-	if(addr > 0x3f) return;
+	if(addr >= CONFIG_MAX) return;
 	config[addr] = val;
 }
 
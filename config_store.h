@@ -6,7 +6,7 @@
  * Version: 1.0
  *
  */
-#define CONFIG_MAX 32
+#define CONFIG_MAX 99
 #define CONFIG_CV1_MAP 0x00
 #define CONFIG_CV2_MAP 0x01
 #define CONFIG_CV1_CHAN 0x02
@@ -33,7 +33,19 @@
 #define CONFIG_VOICE_BEND2 0x17
 #define CONFIG_VOICE_LEGATO_RETRIG1 0x18
 #define CONFIG_VOICE_LEGATO_RETRIG2 0x19
+#define CONFIG_THRU_MODE 0x1a
+#define CONFIG_THRU_CHAN_BLOCKL 0x1b
+#define CONFIG_THRU_CHAN_BLOCKH 0x1c
+#define CONFIG_THRU_CLASS_BLOCK 0x1d
+#define CONFIG_OUTPUT_DELAY 0x1e
 #define CONFIG_SETUP_TOKEN 0x1f
+#define CONFIG_TRIG_NOTES_TOKEN 0x20
+#define CONFIG_TRIG1_NOTES 0x21  // 16 byte note bitmap
+#define CONFIG_TRIG2_NOTES 0x31  // 16 byte note bitmap
+#define CONFIG_TRIG3_NOTES 0x41  // 16 byte note bitmap
+#define CONFIG_TRIG4_NOTES 0x51  // 16 byte note bitmap
+#define CONFIG_CV1_SLEW 0x61
+#define CONFIG_CV2_SLEW 0x62
 
 // init the config store
 void config_store_init(void);
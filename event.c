@@ -30,6 +30,8 @@
 #define MIDI_IN_LED_LEN 2
 #define PITCH_BEND_TRIG_UP 0x27ff
 #define PITCH_BEND_TRIG_DOWN 0x17ff
+#define ACTIVE_SENSE_TIMEOUT 80  // timeout * 4ms - a bit over 300ms
+#define CC_LSB_WAIT 2  // ticks a held CC MSB waits for its LSB - 4-8ms
 
 // event mappings
 #define EVENT_MAP_UNASSIGNED 0
@@ -37,33 +39,31 @@
 #define EVENT_MAP_CC 2
 #define EVENT_MAP_PITCH_BEND 3
 
-// CV/gate
-unsigned char cv1_map;  // CV1 event mapping
-unsigned char cv2_map;  // CV2 event mapping
-unsigned char cv1_chan;  // CV1 receive channel
-unsigned char cv2_chan;  // CV2 receive channel
-unsigned char cv1_val;  // CV1 CC assignment / bend dir
-unsigned char cv2_val;  // CV2 CC assignment / bend dir
-
-// triggers
-unsigned char trig1_map;  // TRIG1 event mapping
-unsigned char trig2_map;  // TRIG2 event mapping
-unsigned char trig3_map;  // TRIG3 event mapping
-unsigned char trig4_map;  // TRIG4 event mapping
-unsigned char trig1_chan;  // TRIG1 receive channel
-unsigned char trig2_chan;  // TRIG2 receive channel
-unsigned char trig3_chan;  // TRIG3 receive channel
-unsigned char trig4_chan;  // TRIG4 receive channel
-unsigned char trig1_val;  // TRIG1 note / CC number / bend dir
-unsigned char trig2_val;  // TRIG2 note / CC number / bend dir
-unsigned char trig3_val;  // TRIG3 note / CC number / bend dir
-unsigned char trig4_val;  // TRIG4 note / CC number / bend dir
+// CV/gate - one entry per output
+unsigned char cv_map[IOCTL_CV_OUTS];  // event mapping
+unsigned char cv_chan[IOCTL_CV_OUTS];  // receive channel
+unsigned char cv_val[IOCTL_CV_OUTS];  // CC assignment / bend dir
+unsigned char cv_msb[IOCTL_CV_OUTS];  // last CC MSB value - CC mapping
+unsigned char cv_lsb_seen[IOCTL_CV_OUTS];  // 1 = the CC source sends LSBs - MSBs wait for them
+unsigned char cv_msb_wait[IOCTL_CV_OUTS];  // 4ms ticks before a held MSB goes out alone - 0 = none held
+
+// triggers - one entry per output
+unsigned char trig_map[IOCTL_TRIG_OUTS];  // event mapping
+unsigned char trig_chan[IOCTL_TRIG_OUTS];  // receive channel
+unsigned char trig_val[IOCTL_TRIG_OUTS];  // note / CC number / bend dir
+
+// routing - outputs that want each message type on each channel
+// one bit per output - CV outputs then trigger outputs - 8 outputs max
+#define ROUTE_CV1 0x01
+#define ROUTE_TRIG1 (ROUTE_CV1 << IOCTL_CV_OUTS)
+unsigned char route_note[16];  // note on / off
+unsigned char route_cc[16];  // control change
+unsigned char route_bend[16];  // pitch bend
+unsigned char trig_notes[IOCTL_TRIG_OUTS << 4];  // note bitmap of each trigger - 16 bytes each
 
 // debug DAC values
-unsigned char cv1_testl;	// CV1 test - lower 5 bits (left just)
-unsigned char cv1_testh;    // CV1 test - upper 7 bits (right just)
-unsigned char cv2_testl;	// CV2 test - lower 5 bits (left just)
-unsigned char cv2_testh;    // CV2 test - upper 7 bits (right just)
+unsigned char cv_testl[IOCTL_CV_OUTS];	// CV test - lower 5 bits (left just)
+unsigned char cv_testh[IOCTL_CV_OUTS];    // CV test - upper 7 bits (right just)
 
 // clock
 unsigned char clock_enabled;  // enable control to follow MIDI start, continue, stop
@@ -71,32 +71,42 @@ unsigned char clock_div;  // the clock divide ratio
 unsigned char clock_count;  // the clock counter
 unsigned char start_arm;  // cause the clock to pulse on the next tick - for SPP and START messages
 
+// active sensing
+unsigned char sense_armed;  // 1 = active sensing has been received
+unsigned char sense_count;  // 4ms ticks since the last message
+
 // local functions
 void event_blink_in(void);
+void event_route_build(void);
+void event_route_add(unsigned char map, unsigned char chan, unsigned char route);
+void event_trig_notes_build(void);
+void event_trig_notes_reset(unsigned char num, unsigned char note);
+void event_release_all(void);
+void event_cv_cc_out(unsigned char num, unsigned int val);
+void event_cv_slew_apply(unsigned char num);
 
 // init the event mapper
 void event_init(void) {
+	unsigned char i;
 	// CV init
-	cv1_map = config_store_get_val(CONFIG_CV1_MAP);
-	cv2_map = config_store_get_val(CONFIG_CV2_MAP);
-	cv1_chan = config_store_get_val(CONFIG_CV1_CHAN);
-	cv2_chan = config_store_get_val(CONFIG_CV2_CHAN);
-	cv1_val = config_store_get_val(CONFIG_CV1_VAL);
-	cv2_val = config_store_get_val(CONFIG_CV2_VAL);
+	for(i = 0; i < IOCTL_CV_OUTS; i ++) {
+		cv_map[i] = config_store_get_val(CONFIG_CV1_MAP + i);
+		cv_chan[i] = config_store_get_val(CONFIG_CV1_CHAN + i);
+		cv_val[i] = config_store_get_val(CONFIG_CV1_VAL + i);
+		cv_msb[i] = 0;
+		cv_lsb_seen[i] = 0;
+		cv_msb_wait[i] = 0;
+		event_set_cv_slew(i, config_store_get_val(CONFIG_CV1_SLEW + i));
+	}
 
 	// trigger init
-	trig1_map = config_store_get_val(CONFIG_TRIG1_MAP);
-	trig2_map = config_store_get_val(CONFIG_TRIG2_MAP);
-	trig3_map = config_store_get_val(CONFIG_TRIG3_MAP);
-	trig4_map = config_store_get_val(CONFIG_TRIG4_MAP);
-	trig1_chan = config_store_get_val(CONFIG_TRIG1_CHAN);
-	trig2_chan = config_store_get_val(CONFIG_TRIG2_CHAN);
-	trig3_chan = config_store_get_val(CONFIG_TRIG3_CHAN);
-	trig4_chan = config_store_get_val(CONFIG_TRIG4_CHAN);
-	trig1_val = config_store_get_val(CONFIG_TRIG1_VAL);
-	trig2_val = config_store_get_val(CONFIG_TRIG2_VAL);
-	trig3_val = config_store_get_val(CONFIG_TRIG3_VAL);
-	trig4_val = config_store_get_val(CONFIG_TRIG4_VAL);
+	for(i = 0; i < IOCTL_TRIG_OUTS; i ++) {
+		trig_map[i] = config_store_get_val(CONFIG_TRIG1_MAP + i);
+		trig_chan[i] = config_store_get_val(CONFIG_TRIG1_CHAN + i);
+		trig_val[i] = config_store_get_val(CONFIG_TRIG1_VAL + i);
+	}
+	event_trig_notes_build();
+	event_route_build();
 
 	// clock init
 	clock_enabled = 0;
@@ -104,150 +114,257 @@ void event_init(void) {
 	clock_count = 0;
 	start_arm = 0;
 
+	// thru init
+	event_set_thru_mode(config_store_get_val(CONFIG_THRU_MODE));
+	event_set_thru_filter(config_store_get_val(CONFIG_THRU_CHAN_BLOCKL) |
+		((unsigned int)config_store_get_val(CONFIG_THRU_CHAN_BLOCKH) << 8),
+		config_store_get_val(CONFIG_THRU_CLASS_BLOCK));
+
+	// output delay init
+	event_set_output_delay(config_store_get_val(CONFIG_OUTPUT_DELAY));
+
+	// active sensing init
+	sense_armed = 0;
+	sense_count = 0;
+
 	// initialize outputs
-	cv1_testl = CV_ZERO_VAL & 0xff;
-	cv1_testh = CV_ZERO_VAL >> 8;
-	cv2_testl = CV_ZERO_VAL & 0xff;
-	cv2_testh = CV_ZERO_VAL >> 8;
-	ioctl_set_cv1_out(CV_ZERO_VAL);
-	ioctl_set_cv2_out(CV_ZERO_VAL);
+	for(i = 0; i < IOCTL_CV_OUTS; i ++) {
+		cv_testl[i] = CV_ZERO_VAL & 0xff;
+		cv_testh[i] = CV_ZERO_VAL >> 8;
+		ioctl_set_cv_out(i, CV_ZERO_VAL);
+	}
 }
 
-// blink the MIDI input LED
+// run the event timer task - every 4ms
+void event_timer_task(void) {
+	unsigned char i;
+	// a held CC MSB that got no LSB goes out on its own
+	for(i = 0; i < IOCTL_CV_OUTS; i ++) {
+		if(cv_msb_wait[i]) {
+			cv_msb_wait[i] --;
+			if(cv_msb_wait[i] == 0) event_cv_cc_out(i, (unsigned int)cv_msb[i] << 7);
+		}
+	}
+	if(!sense_armed) return;
+	sense_count ++;
+	if(sense_count < ACTIVE_SENSE_TIMEOUT) return;
+	// the sender has gone away - wait for active sensing to start again
+	sense_armed = 0;
+	event_release_all();
+}
+
+// blink the MIDI input LED - this is called for every message
 void event_blink_in(void) {
 	ioctl_set_midi_in_led(MIDI_IN_LED_LEN, 0);
+	sense_count = 0;
 }
 
-//
-// MIDI CALLBACKS
-//
-//
-// CHANNEL MESSAGES
-//
-// note off - note on with velocity = 0 calls this
-void _midi_rx_note_off(unsigned char channel, 
-		unsigned char note) {
-	// CV/gate - note off
-	if(cv1_map == EVENT_MAP_NOTE && cv1_chan == channel) {
-		voice_note_off(0, note);
+// set a CC mapped CV/gate from a 14 bit value
+void event_cv_cc_out(unsigned char num, unsigned int val) {
+	ioctl_set_cv_out(num, 4095 - (val >> 2));
+	ioctl_set_cv_led(num, CV_LED_LEN, 0);
+	if(val & 0x2000) {
+		ioctl_set_gate_out(num, 255);
+		ioctl_set_gate_led(num, 255, 0);
 	}
-	if(cv2_map == EVENT_MAP_NOTE && cv2_chan == channel) {
-		voice_note_off(1, note);
+	else {
+		ioctl_set_gate_out(num, 0);
+		ioctl_set_gate_led(num, 0, 0);
 	}
+}
 
-	// echo and blink
-	_midi_tx_note_off(channel, note);
-	event_blink_in();
+// release all voices, triggers and clock outputs
+void event_release_all(void) {
+	unsigned char i;
+	// this resets CV/gate outputs
+	voice_state_reset();
+	// reset all trigger and clock outputs
+	for(i = 0; i < IOCTL_TRIG_OUTS; i ++) {
+		ioctl_set_trig_out(i, 0);
+	}
+	ioctl_set_clock_out(0);
+	ioctl_set_reset_out(0);
 }
 
-// note on - note on with velocity > 0 calls this
-void _midi_rx_note_on(unsigned char channel, 
+//
+// MIDI CALLBACKS
+//
+//
+// SETUP MESSAGES
+//
+// these are only called while a setup mode is active - each one learns
+// the mapping for the current setup mode and then plays the message
+// note on setup
+void _midi_setup_note_on(unsigned char channel, 
 		unsigned char note, 
 		unsigned char velocity) {
+	unsigned char temp = setup_get_mode();
 	if(channel == 15) return;  // channel 16 is not used for notes
+	if(temp == SETUP_MODE_CV1) {
+		event_set_cv(0, EVENT_MAP_NOTE, channel, 0);
+		voice_set_mode(VOICE_MODE_SINGLE, 0);
+		voice_set_unit(0);  // always unit 0
+		setup_mode_cancel();
+	}
+	else if(temp == SETUP_MODE_CV2) {
+		event_set_cv(1, EVENT_MAP_NOTE, channel, 0);
+		voice_set_mode(VOICE_MODE_SINGLE, 0);
+		voice_set_unit(0);  // always unit 0
+		setup_mode_cancel();
+	}
+	else if(temp == SETUP_MODE_CV_SPLIT) {
+		event_set_cv(0, EVENT_MAP_NOTE, channel, 0);
+		event_set_cv(1, EVENT_MAP_NOTE, channel, 0); 
+		voice_set_mode(VOICE_MODE_SPLIT, note);
+		voice_set_unit(0);  // always unit 0
+		setup_mode_cancel();
+	}
+	else if(temp == SETUP_MODE_CV_POLY) {
+		event_set_cv(0, EVENT_MAP_NOTE, channel, 0);
+		event_set_cv(1, EVENT_MAP_NOTE, channel, 0);
+		voice_set_mode(VOICE_MODE_POLY, 0);
+		if(note == 62) voice_set_unit(1);  // D4
+		else if(note == 64) voice_set_unit(2);  // E4
+		else if(note == 65) voice_set_unit(3);  // F4
+		else if(note == 67) voice_set_unit(4);  // G4
+		else if(note == 69) voice_set_unit(5);  // A4
+		else if(note == 71) voice_set_unit(6);  // B4
+		else if(note == 72) voice_set_unit(7);  // C5
+		else voice_set_unit(0);  // C4 (or default)
+		setup_mode_cancel();
+	}
+	else if(temp == SETUP_MODE_CV_ARP) {
+		event_set_cv(0, EVENT_MAP_NOTE, channel, 0);
+		event_set_cv(1, EVENT_MAP_NOTE, channel, 0); 
+		voice_set_mode(VOICE_MODE_ARP, 0);
+		voice_set_unit(0);  // always unit 0
+		setup_mode_cancel();
+	}
+	// set up velocity mode on CV/gate 1 and CV/gate 2
+	else if(temp == SETUP_MODE_CV_VELO) {
+		event_set_cv(0, EVENT_MAP_NOTE, channel, 0);
+		event_set_cv(1, EVENT_MAP_NOTE, channel, 0); 
+		voice_set_mode(VOICE_MODE_VELO, 0);
+		voice_set_unit(0);  // always unit 0
+		setup_mode_cancel();
+	}
+	else if(temp >= SETUP_MODE_TRIG1 && temp <= SETUP_MODE_TRIG4) {
+		event_set_trig(temp - SETUP_MODE_TRIG1, EVENT_MAP_NOTE, channel, note);
+		setup_mode_cancel();
+	}
+	_midi_rx_note_on(channel, note, velocity);
+}
 
-	//
-	// SETUP
-	//
-	// note setup mode
+// control change setup
+void _midi_setup_control_change(unsigned char channel,
+		unsigned char controller,
+		unsigned char value) {
 	unsigned char temp = setup_get_mode();
-	if(temp != SETUP_MODE_NONE) {
-		if(temp == SETUP_MODE_CV1) {
-			event_set_cv(0, EVENT_MAP_NOTE, channel, 0);
-			voice_set_mode(VOICE_MODE_SINGLE, 0);
-			voice_set_unit(0);  // always unit 0
-			setup_mode_cancel();
-		}
-		else if(temp == SETUP_MODE_CV2) {
-			event_set_cv(1, EVENT_MAP_NOTE, channel, 0);
-			voice_set_mode(VOICE_MODE_SINGLE, 0);
-			voice_set_unit(0);  // always unit 0
-			setup_mode_cancel();
-		}
-		else if(temp == SETUP_MODE_CV_SPLIT) {
-			event_set_cv(0, EVENT_MAP_NOTE, channel, 0);
-			event_set_cv(1, EVENT_MAP_NOTE, channel, 0); 
-			voice_set_mode(VOICE_MODE_SPLIT, note);
-			voice_set_unit(0);  // always unit 0
-			setup_mode_cancel();
-		}
-		else if(temp == SETUP_MODE_CV_POLY) {
-			event_set_cv(0, EVENT_MAP_NOTE, channel, 0);
-			event_set_cv(1, EVENT_MAP_NOTE, channel, 0);
-			voice_set_mode(VOICE_MODE_POLY, 0);
-			if(note == 62) voice_set_unit(1);  // D4
-			else if(note == 64) voice_set_unit(2);  // E4
-			else if(note == 65) voice_set_unit(3);  // F4
-			else if(note == 67) voice_set_unit(4);  // G4
-			else if(note == 69) voice_set_unit(5);  // A4
-			else if(note == 71) voice_set_unit(6);  // B4
-			else if(note == 72) voice_set_unit(7);  // C5
-			else voice_set_unit(0);  // C4 (or default)
-			setup_mode_cancel();
-		}
-		else if(temp == SETUP_MODE_CV_ARP) {
-			event_set_cv(0, EVENT_MAP_NOTE, channel, 0);
-			event_set_cv(1, EVENT_MAP_NOTE, channel, 0); 
-			voice_set_mode(VOICE_MODE_ARP, 0);
-			voice_set_unit(0);  // always unit 0
+	if(channel == 15) return;  // channel 16 is reserved
+	if(controller > 121) return;  // CC #122-127 cannot be assigned
+	if(temp == SETUP_MODE_CV1) {
+		event_set_cv(0, EVENT_MAP_CC, channel, controller);
+		setup_mode_cancel();
+	}
+	else if(temp == SETUP_MODE_CV2) {
+		event_set_cv(1, EVENT_MAP_CC, channel, controller);
+		setup_mode_cancel();
+	}
+	else if(temp >= SETUP_MODE_TRIG1 && temp <= SETUP_MODE_TRIG4) {
+		event_set_trig(temp - SETUP_MODE_TRIG1, EVENT_MAP_CC, channel, controller);
+		setup_mode_cancel();
+	}
+	_midi_rx_control_change(channel, controller, value);
+}
+
+// pitch bend setup
+void _midi_setup_pitch_bend(unsigned char channel,
+		unsigned int bend) {
+	unsigned char temp = setup_get_mode();
+	if(channel == 15) return;  // channel 16 is reserved
+	if(temp == SETUP_MODE_CV1) {
+		if(bend > PITCH_BEND_TRIG_UP) {
+			event_set_cv(0, EVENT_MAP_PITCH_BEND, channel, 1);
 			setup_mode_cancel();
 		}
-		// set up velocity mode on CV/gate 1 and CV/gate 2
-		else if(temp == SETUP_MODE_CV_VELO) {
-			event_set_cv(0, EVENT_MAP_NOTE, channel, 0);
-			event_set_cv(1, EVENT_MAP_NOTE, channel, 0); 
-			voice_set_mode(VOICE_MODE_VELO, 0);
-			voice_set_unit(0);  // always unit 0
+		else if(bend < PITCH_BEND_TRIG_DOWN) {
+			event_set_cv(0, EVENT_MAP_PITCH_BEND, channel, 0);
 			setup_mode_cancel();
 		}
-		else if(temp == SETUP_MODE_TRIG1) {
-			event_set_trig(0, EVENT_MAP_NOTE, channel, note);
+	}
+	else if(temp == SETUP_MODE_CV2) {
+		if(bend > PITCH_BEND_TRIG_UP) {
+			event_set_cv(1, EVENT_MAP_PITCH_BEND, channel, 1);
 			setup_mode_cancel();
 		}
-		else if(temp == SETUP_MODE_TRIG2) {
-			event_set_trig(1, EVENT_MAP_NOTE, channel, note);
+		else if(bend < PITCH_BEND_TRIG_DOWN) {
+			event_set_cv(1, EVENT_MAP_PITCH_BEND, channel, 0);
 			setup_mode_cancel();
 		}
-		else if(temp == SETUP_MODE_TRIG3) {
-			event_set_trig(2, EVENT_MAP_NOTE, channel, note);
+	}
+	else if(temp >= SETUP_MODE_TRIG1 && temp <= SETUP_MODE_TRIG4) {
+		if(bend > PITCH_BEND_TRIG_UP) {
+			event_set_trig(temp - SETUP_MODE_TRIG1, EVENT_MAP_PITCH_BEND, channel, 1);
 			setup_mode_cancel();
 		}
-		else if(temp == SETUP_MODE_TRIG4) {
-			event_set_trig(3, EVENT_MAP_NOTE, channel, note);
+		else if(bend < PITCH_BEND_TRIG_DOWN) {
+			event_set_trig(temp - SETUP_MODE_TRIG1, EVENT_MAP_PITCH_BEND, channel, 0);
 			setup_mode_cancel();
 		}
 	}
+	_midi_rx_pitch_bend(channel, bend);
+}
 
-	//
-	// PLAYING
-	//
-	// note CV/gate
-	if(cv1_map == EVENT_MAP_NOTE && cv1_chan == channel) {
-		voice_note_on(0, note, velocity);
-	}
-	if(cv2_map == EVENT_MAP_NOTE && cv2_chan == channel) {
-		voice_note_on(1, note, velocity);
-	}
-	// note triggers
-	if(trig1_map == EVENT_MAP_NOTE && trig1_chan == channel && trig1_val == note) {
-		ioctl_set_trig1_out(TRIG_OUT_LEN);
-		ioctl_set_trig1_led(TRIG_LED_LEN, 0);
-	}
-	if(trig2_map == EVENT_MAP_NOTE && trig2_chan == channel && trig2_val == note) {
-		ioctl_set_trig2_out(TRIG_OUT_LEN); 
-		ioctl_set_trig2_led(TRIG_LED_LEN, 0);
-	}
-	if(trig3_map == EVENT_MAP_NOTE && trig3_chan == channel && trig3_val == note) {
-		ioctl_set_trig3_out(TRIG_OUT_LEN); 
-		ioctl_set_trig3_led(TRIG_LED_LEN, 0);
+//
+// CHANNEL MESSAGES
+//
+// note off - note on with velocity = 0 calls this
+void _midi_rx_note_off(unsigned char channel, 
+		unsigned char note) {
+	// CV/gate - note off
+	unsigned char i, bit;
+	unsigned char routes = route_note[channel];
+	bit = ROUTE_CV1;
+	for(i = 0; i < IOCTL_CV_OUTS; i ++) {
+		if(routes & bit) voice_note_off(i, note);
+		bit <<= 1;
 	}
-	if(trig4_map == EVENT_MAP_NOTE && trig4_chan == channel && trig4_val == note) {
-		ioctl_set_trig4_out(TRIG_OUT_LEN); 
-		ioctl_set_trig4_led(TRIG_LED_LEN, 0);
+
+	// echo and blink
+	if(midi_thru_echo(MIDI_THRU_NOTE, channel)) _midi_tx_note_off(channel, note);
+	event_blink_in();
+}
+
+// note on - note on with velocity > 0 calls this
+void _midi_rx_note_on(unsigned char channel, 
+		unsigned char note, 
+		unsigned char velocity) {
+	unsigned char i, bit, routes;
+	if(channel == 15) return;  // channel 16 is not used for notes
+
+	// only visit the outputs mapped to this channel
+	routes = route_note[channel];
+	if(routes) {
+		// note CV/gate
+		bit = ROUTE_CV1;
+		for(i = 0; i < IOCTL_CV_OUTS; i ++) {
+			if(routes & bit) voice_note_on(i, note, velocity);
+			bit <<= 1;
+		}
+		// note triggers - each trigger has a bitmap of notes it fires on
+		bit = ROUTE_TRIG1;
+		for(i = 0; i < IOCTL_TRIG_OUTS; i ++) {
+			if((routes & bit) && 
+					(trig_notes[(i << 4) + (note >> 3)] & (1 << (note & 0x07)))) {
+				ioctl_set_trig_out(i, TRIG_OUT_LEN);
+				ioctl_set_trig_led(i, TRIG_LED_LEN, 0);
+			}
+			bit <<= 1;
+		}
 	}
 
 	// echo and blink
-	_midi_tx_note_on(channel, note, velocity);
+	if(midi_thru_echo(MIDI_THRU_NOTE, channel)) _midi_tx_note_on(channel, note, velocity);
 	event_blink_in();
 }
 
@@ -255,190 +372,86 @@ void _midi_rx_note_on(unsigned char channel,
 void _midi_rx_control_change(unsigned char channel,
 		unsigned char controller,
 		unsigned char value) {
-	//
-	// SETUP
-	//
-	// CC setup mode
-	unsigned char temp = setup_get_mode();
-	if(temp != SETUP_MODE_NONE) {
-		if(channel == 15) return;  // channel 16 is reserved
-		if(controller > 121) return;  // CC #122-127 cannot be assigned
-		if(temp == SETUP_MODE_CV1) {
-			event_set_cv(0, EVENT_MAP_CC, channel, controller);
-			setup_mode_cancel();
-		}
-		else if(temp == SETUP_MODE_CV2) {
-			event_set_cv(1, EVENT_MAP_CC, channel, controller);
-			setup_mode_cancel();
-		}
-		else if(temp == SETUP_MODE_TRIG1) {
-			event_set_trig(0, EVENT_MAP_CC, channel, controller);
-			setup_mode_cancel();
-		}
-		else if(temp == SETUP_MODE_TRIG2) {
-			event_set_trig(1, EVENT_MAP_CC, channel, controller);
-			setup_mode_cancel();
-		}
-		else if(temp == SETUP_MODE_TRIG3) {
-			event_set_trig(2, EVENT_MAP_CC, channel, controller);
-			setup_mode_cancel();
-		}
-		else if(temp == SETUP_MODE_TRIG4) {
-			event_set_trig(3, EVENT_MAP_CC, channel, controller);
-			setup_mode_cancel();
-		}
-	}
-
-	//
-	// PLAYING
-	//
-	// CC in note mode - CV1
-	if(cv1_map == EVENT_MAP_NOTE && cv1_chan == channel) {
-		// legato retrig mode control
-		if(controller == 20) {
-			voice_set_legato_retrig(0, value >> 6);
-		}
-		// damper pedal
-		else if(controller == 64) {
-			voice_damper(0, value);
-		}
-	}
-	// CC in note mode - CV2
-	if(cv2_map == EVENT_MAP_NOTE && cv2_chan == channel) {
-		// legato retrig mode control
-		if(controller == 20) {
-			voice_set_legato_retrig(1, value >> 6);
-		}
-		// damper pedal
-		else if(controller == 64) {
-			voice_damper(1, value);
-		}
-	}
-	// CC CV/gate
-	if(cv1_map == EVENT_MAP_CC && cv1_chan == channel && cv1_val == controller) {
-		ioctl_set_cv1_out(4095 - (value << 5));
-		ioctl_set_cv1_led(CV_LED_LEN, 0);
-		if(value & 0x40) {
-			ioctl_set_gate1_out(255);
-			ioctl_set_gate1_led(255, 0);
-		}
-		else {
-			ioctl_set_gate1_out(0);
-			ioctl_set_gate1_led(0, 0);
-		}
-	}
-	if(cv2_map == EVENT_MAP_CC && cv2_chan == channel && cv2_val == controller) {
-		ioctl_set_cv2_out(4095 - (value << 5));
-		ioctl_set_cv2_led(CV_LED_LEN, 0);
-		if(value & 0x40) {
-			ioctl_set_gate2_out(255);
-			ioctl_set_gate2_led(255, 0);
-		}
-		else {
-			ioctl_set_gate2_out(0);
-			ioctl_set_gate2_led(0, 0);
+	unsigned char i, bit, routes, temp;
+	// only visit the outputs mapped to this channel
+	routes = route_cc[channel];
+	if(routes) {
+		bit = ROUTE_CV1;
+		for(i = 0; i < IOCTL_CV_OUTS; i ++) {
+			if(routes & bit) {
+				// CC in note mode
+				if(cv_map[i] == EVENT_MAP_NOTE) {
+					// legato retrig mode control
+					if(controller == 20) {
+						voice_set_legato_retrig(i, value >> 6);
+					}
+					// damper pedal
+					else if(controller == 64) {
+						voice_damper(i, value);
+					}
+				}
+				// CC CV/gate - MSB or 7 bit CC - a new MSB clears the LSB
+				// a 7 bit source goes straight out - once LSBs have been seen
+				// the MSB is held so each pair makes one DAC write
+				else if(cv_val[i] == controller) {
+					if(cv_msb_wait[i]) event_cv_cc_out(i, (unsigned int)cv_msb[i] << 7);
+					cv_msb[i] = value;
+					if(cv_lsb_seen[i]) cv_msb_wait[i] = CC_LSB_WAIT;
+					else event_cv_cc_out(i, (unsigned int)value << 7);
+				}
+				// CC CV/gate - LSB of CC 0-31 is CC 32-63 - completes the last MSB
+				else if(cv_val[i] < 32 && cv_val[i] + 32 == controller) {
+					cv_lsb_seen[i] = 1;
+					cv_msb_wait[i] = 0;
+					event_cv_cc_out(i, ((unsigned int)cv_msb[i] << 7) | value);
+				}
+			}
+			bit <<= 1;
+		}
+		// CC trigger
+		for(i = 0; i < IOCTL_TRIG_OUTS; i ++) {
+			if((routes & bit) && trig_val[i] == controller) {
+				if(value & 0x40) {
+					ioctl_set_trig_out(i, 255);
+					ioctl_set_trig_led(i, 255, 0);
+				}
+				else {
+					ioctl_set_trig_out(i, 0);
+					ioctl_set_trig_led(i, 0, 0);
+				}
+			}
+			bit <<= 1;
 		}
 	}
-	// CC trigger
-	if(trig1_map == EVENT_MAP_CC && trig1_chan == channel && trig1_val == controller) {
-		if(value & 0x40) {
-			ioctl_set_trig1_out(255);
-			ioctl_set_trig1_led(255, 0);
-		}
-		else {
-			ioctl_set_trig1_out(0);
-			ioctl_set_trig1_led(0, 0);
-		}
-	}	
-	if(trig2_map == EVENT_MAP_CC && trig2_chan == channel && trig2_val == controller) {
-		if(value & 0x40) {
-			ioctl_set_trig2_out(255);
-			ioctl_set_trig2_led(255, 0);
-		}
-		else {
-			ioctl_set_trig2_out(0);
-			ioctl_set_trig2_led(0, 0);
-		}
-	}	
-	if(trig3_map == EVENT_MAP_CC && trig3_chan == channel && trig3_val == controller) {
-		if(value & 0x40) {
-			ioctl_set_trig3_out(255);
-			ioctl_set_trig3_led(255, 0);
-		}
-		else {
-			ioctl_set_trig3_out(0);
-			ioctl_set_trig3_led(0, 0);
-		}
-	}	
-	if(trig4_map == EVENT_MAP_CC && trig4_chan == channel && trig4_val == controller) {
-		if(value & 0x40) {
-			ioctl_set_trig4_out(255);
-			ioctl_set_trig4_led(255, 0);
-		}
-		else {
-			ioctl_set_trig4_out(0);
-			ioctl_set_trig4_led(0, 0);
-		}
-	}	
-	// CC channel 16 direct control mode
+	// CC channel 16 direct control mode - no slew
 	if(channel == 15) {
 		// make the value 8 bit
 		temp = (value << 1);
 		if(value) temp |= 0x01;
 
-		// CV1 value - MSB
-		if(controller == 16) {
-			cv1_testh = value;
-			ioctl_set_cv1_out((cv1_testh << 5) | (cv1_testl >> 2));
-			ioctl_set_cv1_led(CV_LED_LEN, 0);
-		}
-		// CV1 value - LSB
-		else if(controller == 48) {
-			cv1_testl = value;
-			ioctl_set_cv1_out((cv1_testh << 5) | (cv1_testl >> 2));
-			ioctl_set_cv1_led(CV_LED_LEN, 0);
-		}
-		// CV2 value - MSB
-		else if(controller == 17) {
-			cv2_testh = value;
-			ioctl_set_cv2_out((cv2_testh << 5) | (cv2_testl >> 2));
-			ioctl_set_cv2_led(CV_LED_LEN, 0);
-		}
-		// CV2 value - LSB
-		else if(controller == 49) {
-			cv2_testl = value;
-			ioctl_set_cv2_out((cv2_testh << 5) | (cv2_testl >> 2));
-			ioctl_set_cv2_led(CV_LED_LEN, 0);
-		}
-		// gate 1
-		else if(controller == 18) {
-			ioctl_set_gate1_out(temp);
-			ioctl_set_gate1_led(temp, 0);
-		}
-		// gate 2
-		else if(controller == 19) {
-			ioctl_set_gate2_out(temp);
-			ioctl_set_gate2_led(temp, 0);
-		}
-		// trig 1
-		else if(controller == 70) {
-			ioctl_set_trig1_out(temp);
-			ioctl_set_trig1_led(temp, 0);
-		}
-		// trig 2
-		else if(controller == 71) {
-			ioctl_set_trig2_out(temp);
-			ioctl_set_trig2_led(temp, 0);
-		}
-		// trig 3
-		else if(controller == 72) {
-			ioctl_set_trig3_out(temp);
-			ioctl_set_trig3_led(temp, 0);
-		}
-		// trig 4
-		else if(controller == 73) {
-			ioctl_set_trig4_out(temp);
-			ioctl_set_trig4_led(temp, 0);
+		// CV value - MSB - CC 16 and up
+		if(controller >= 16 && controller < 16 + IOCTL_CV_OUTS) {
+			i = controller - 16;
+			cv_testh[i] = value;
+			ioctl_set_cv_exact(i, (cv_testh[i] << 5) | (cv_testl[i] >> 2));
+			ioctl_set_cv_led(i, CV_LED_LEN, 0);
+		}
+		// CV value - LSB - CC 48 and up
+		else if(controller >= 48 && controller < 48 + IOCTL_CV_OUTS) {
+			i = controller - 48;
+			cv_testl[i] = value;
+			ioctl_set_cv_exact(i, (cv_testh[i] << 5) | (cv_testl[i] >> 2));
+			ioctl_set_cv_led(i, CV_LED_LEN, 0);
+		}
+		// gate - CC 18 and up
+		else if(controller >= 18 && controller < 18 + IOCTL_CV_OUTS) {
+			ioctl_set_gate_out(controller - 18, temp);
+			ioctl_set_gate_led(controller - 18, temp, 0);
+		}
+		// trig - CC 70 and up
+		else if(controller >= 70 && controller < 70 + IOCTL_TRIG_OUTS) {
+			ioctl_set_trig_out(controller - 70, temp);
+			ioctl_set_trig_led(controller - 70, temp, 0);
 		}
 		// clock
 		else if(controller == 74) {
@@ -453,197 +466,94 @@ void _midi_rx_control_change(unsigned char channel,
 	}
 
 	// echo and blink
-	_midi_tx_control_change(channel, controller, value);
+	if(midi_thru_echo(MIDI_THRU_CC, channel)) _midi_tx_control_change(channel, controller, value);
 	event_blink_in();
 }
 
 // pitch bend
 void _midi_rx_pitch_bend(unsigned char channel,
 		unsigned int bend) {
-	//
-	// SETUP
-	//
-	// pitch bend setup mode
-	unsigned char temp = setup_get_mode();
-	if(temp != SETUP_MODE_NONE) {
-		if(channel == 15) return;  // channel 16 is reserved
-		if(temp == SETUP_MODE_CV1) {
-			if(bend > PITCH_BEND_TRIG_UP) {
-				event_set_cv(0, EVENT_MAP_PITCH_BEND, channel, 1);
-				setup_mode_cancel();
-			}
-			else if(bend < PITCH_BEND_TRIG_DOWN) {
-				event_set_cv(0, EVENT_MAP_PITCH_BEND, channel, 0);
-				setup_mode_cancel();
-			}
-		}
-		else if(temp == SETUP_MODE_CV2) {
-			if(bend > PITCH_BEND_TRIG_UP) {
-				event_set_cv(1, EVENT_MAP_PITCH_BEND, channel, 1);
-				setup_mode_cancel();
-			}
-			else if(bend < PITCH_BEND_TRIG_DOWN) {
-				event_set_cv(1, EVENT_MAP_PITCH_BEND, channel, 0);
-				setup_mode_cancel();
-			}
-		}
-		else if(temp == SETUP_MODE_TRIG1) {
-			if(bend > PITCH_BEND_TRIG_UP) {
-				event_set_trig(0, EVENT_MAP_PITCH_BEND, channel, 1);
-				setup_mode_cancel();
-			}
-			else if(bend < PITCH_BEND_TRIG_DOWN) {
-				event_set_trig(0, EVENT_MAP_PITCH_BEND, channel, 0);
-				setup_mode_cancel();
-			}
-		}
-		else if(temp == SETUP_MODE_TRIG2) {
-			if(bend > PITCH_BEND_TRIG_UP) {
-				event_set_trig(1, EVENT_MAP_PITCH_BEND, channel, 1);
-				setup_mode_cancel();
-			}
-			else if(bend < PITCH_BEND_TRIG_DOWN) {
-				event_set_trig(1, EVENT_MAP_PITCH_BEND, channel, 0);
-				setup_mode_cancel();
-			}
-		}
-		else if(temp == SETUP_MODE_TRIG3) {
-			if(bend > PITCH_BEND_TRIG_UP) {
-				event_set_trig(2, EVENT_MAP_PITCH_BEND, channel, 1);
-				setup_mode_cancel();
-			}
-			else if(bend < PITCH_BEND_TRIG_DOWN) {
-				event_set_trig(2, EVENT_MAP_PITCH_BEND, channel, 0);
-				setup_mode_cancel();
-			}
-		}
-		else if(temp == SETUP_MODE_TRIG4) {
-			if(bend > PITCH_BEND_TRIG_UP) {
-				event_set_trig(3, EVENT_MAP_PITCH_BEND, channel, 1);
-				setup_mode_cancel();
+	unsigned char i, bit, routes;
+	// only visit the outputs mapped to this channel
+	routes = route_bend[channel];
+	if(routes) {
+		bit = ROUTE_CV1;
+		for(i = 0; i < IOCTL_CV_OUTS; i ++) {
+			if(routes & bit) {
+				// pitch bend - note bend mode
+				if(cv_map[i] == EVENT_MAP_NOTE) {
+					voice_pitch_bend(i, bend);
+				}
+				// pitch bend CV/gate - normal bend
+				else if(cv_val[i] == 1) {
+					ioctl_set_cv_out(i, 4095 - (bend >> 2));
+					ioctl_set_cv_led(i, CV_LED_LEN, 0);
+					if(bend > PITCH_BEND_TRIG_UP) {
+						ioctl_set_gate_out(i, 255);
+						ioctl_set_gate_led(i, 255, 255);
+					}
+					else {
+						ioctl_set_gate_out(i, 0);
+						ioctl_set_gate_led(i, 0, 0);
+					}
+				}
+				// pitch bend CV/gate - reverse bend - CV1 drives GATE2 on bend up
+				else if(i == 0) {
+					ioctl_set_cv_out(i, bend >> 2);
+					ioctl_set_cv_led(i, CV_LED_LEN, 0);
+					if(bend > PITCH_BEND_TRIG_UP) {
+						ioctl_set_gate_out(1, 255);
+						ioctl_set_gate_led(1, 255, 255);
+					}
+					else {
+						ioctl_set_gate_out(1, 0);
+						ioctl_set_gate_led(1, 0, 0);
+					}
+				}
+				// pitch bend CV/gate - reverse bend
+				else {
+					ioctl_set_cv_out(i, bend >> 2);
+					ioctl_set_cv_led(i, CV_LED_LEN, 0);
+					if(bend < PITCH_BEND_TRIG_DOWN) {
+						ioctl_set_gate_out(i, 255);
+						ioctl_set_gate_led(i, 255, 255);
+					}
+					else {
+						ioctl_set_gate_out(i, 0);
+						ioctl_set_gate_led(i, 0, 0);
+					}
+				}
 			}
-			else if(bend < PITCH_BEND_TRIG_DOWN) {
-				event_set_trig(3, EVENT_MAP_PITCH_BEND, channel, 0);
-				setup_mode_cancel();
+			bit <<= 1;
+		}
+		// pitch bend triggers
+		for(i = 0; i < IOCTL_TRIG_OUTS; i ++) {
+			if(routes & bit) {
+				if(trig_val[i] == 1 && bend > PITCH_BEND_TRIG_UP ||
+						trig_val[i] == 0 && bend < PITCH_BEND_TRIG_DOWN) {
+					ioctl_set_trig_out(i, 255);
+					ioctl_set_trig_led(i, 255, 255);
+				}
+				else {
+					ioctl_set_trig_out(i, 0);
+					ioctl_set_trig_led(i, 0, 0);
+				}
 			}
+			bit <<= 1;
 		}
 	}
-
-	//
-	// PLAYING
-	//
-	// pitch bend - note bend mode
-	if(cv1_map == EVENT_MAP_NOTE && cv1_chan == channel) {
-		voice_pitch_bend(0, bend);
-	}
-	if(cv2_map == EVENT_MAP_NOTE && cv2_chan == channel) {
-		voice_pitch_bend(1, bend);
-	}
-	// pitch bend CV/gate
-	if(cv1_map == EVENT_MAP_PITCH_BEND && cv1_chan == channel) {
-		// normal bend
-		if(cv1_val == 1) {
-			ioctl_set_cv1_out(4095 - (bend >> 2));
-			ioctl_set_cv1_led(CV_LED_LEN, 0);
-			if(bend > PITCH_BEND_TRIG_UP) {
-				ioctl_set_gate1_out(255);
-				ioctl_set_gate1_led(255, 255);
-			}
-			else {
-				ioctl_set_gate1_out(0);
-				ioctl_set_gate1_led(0, 0);
-			}
-		}
-		// reverse bend
-		else {
-			ioctl_set_cv1_out(bend >> 2);
-			ioctl_set_cv1_led(CV_LED_LEN, 0);
-			if(bend > PITCH_BEND_TRIG_UP) {
-				ioctl_set_gate2_out(255);
-				ioctl_set_gate2_led(255, 255);
-			}
-			else {
-				ioctl_set_gate2_out(0);
-				ioctl_set_gate2_led(0, 0);
-			}
-		}
-	}
-	if(cv2_map == EVENT_MAP_PITCH_BEND && cv2_chan == channel) {
-		// normal bend
-		if(cv2_val == 1) {
-			ioctl_set_cv2_out(4095 - (bend >> 2));
-			ioctl_set_cv2_led(CV_LED_LEN, 0);
-			if(bend > PITCH_BEND_TRIG_UP) {
-				ioctl_set_gate2_out(255);
-				ioctl_set_gate2_led(255, 255);
-			}
-			else {
-				ioctl_set_gate2_out(0);
-				ioctl_set_gate2_led(0, 0);
-			}
-		}
-		// reverse bend
-		else {
-			ioctl_set_cv2_out(bend >> 2);
-			ioctl_set_cv2_led(CV_LED_LEN, 0);
-			if(bend < PITCH_BEND_TRIG_DOWN) {
-				ioctl_set_gate2_out(255);
-				ioctl_set_gate2_led(255, 255);
-			}
-			else {
-				ioctl_set_gate2_out(0);
-				ioctl_set_gate2_led(0, 0);
-			}
-		}
-	}
-	// pitch bend triggers
-	if(trig1_map == EVENT_MAP_PITCH_BEND && trig1_chan == channel) {
-		if(trig1_val == 1 && bend > PITCH_BEND_TRIG_UP ||
-				trig1_val == 0 && bend < PITCH_BEND_TRIG_DOWN) {
-			ioctl_set_trig1_out(255);
-			ioctl_set_trig1_led(255, 255);
-		}
-		else {
-			ioctl_set_trig1_out(0);
-			ioctl_set_trig1_led(0, 0);
-		}			
-	}
-	if(trig2_map == EVENT_MAP_PITCH_BEND && trig2_chan == channel) {
-		if(trig2_val == 1 && bend > PITCH_BEND_TRIG_UP ||
-				trig2_val == 0 && bend < PITCH_BEND_TRIG_DOWN) {
-			ioctl_set_trig2_out(255);
-			ioctl_set_trig2_led(255, 255);
-		}
-		else {
-			ioctl_set_trig2_out(0);
-			ioctl_set_trig2_led(0, 0);
-		}			
-	}
-	if(trig3_map == EVENT_MAP_PITCH_BEND && trig3_chan == channel) {
-		if(trig3_val == 1 && bend > PITCH_BEND_TRIG_UP ||
-				trig3_val == 0 && bend < PITCH_BEND_TRIG_DOWN) {
-			ioctl_set_trig3_out(255);
-			ioctl_set_trig3_led(255, 255);
-		}
-		else {
-			ioctl_set_trig3_out(0);
-			ioctl_set_trig3_led(0, 0);
-		}			
-	}
-	if(trig4_map == EVENT_MAP_PITCH_BEND && trig4_chan == channel) {
-		if(trig4_val == 1 && bend > PITCH_BEND_TRIG_UP ||
-				trig4_val == 0 && bend < PITCH_BEND_TRIG_DOWN) {
-			ioctl_set_trig4_out(255);
-			ioctl_set_trig4_led(255, 255);
-		}
-		else {
-			ioctl_set_trig4_out(0);
-			ioctl_set_trig4_led(0, 0);
-		}			
+	// channel 16 direct control mode - 14 bit CV1 in one message - no slew
+	// a bend carries one value and there is one direct channel so it can only
+	// drive one CV - the sysex direct frame sets both CVs and gates at once
+	if(channel == 15) {
+		cv_testh[0] = bend >> 7;
+		cv_testl[0] = bend & 0x7f;
+		ioctl_set_cv_exact(0, bend >> 2);
+		ioctl_set_cv_led(0, CV_LED_LEN, 0);
 	}
 
 	// echo and blink
-	_midi_tx_pitch_bend(channel, bend);
+	if(midi_thru_echo(MIDI_THRU_BEND, channel)) _midi_tx_pitch_bend(channel, bend);
 	event_blink_in();
 }
 
@@ -664,22 +574,17 @@ void _midi_rx_program_change(unsigned char channel,
 	}
 
 	// echo and blink
-	_midi_tx_program_change(channel, program);
+	if(midi_thru_echo(MIDI_THRU_PROGRAM, channel)) _midi_tx_program_change(channel, program);
 	event_blink_in();
 }
 
 //
 // SYSTEM COMMON MESSAGES
 //
-// song position
+// song position - the clock was already moved by _midi_isr_song_position()
 void _midi_rx_song_position(unsigned int pos) {
-	unsigned long ticks = (pos * 6);
-	clock_count = ticks % clock_div;
-	if(clock_count == 0) {
-		start_arm = 1;
-	}	
 	// echo and blink
-	_midi_tx_song_position(pos);
+	if(midi_thru_echo(MIDI_THRU_CLOCK, MIDI_THRU_NO_CHAN)) _midi_tx_song_position(pos);
 	event_blink_in();
 }
 
@@ -710,66 +615,44 @@ void _midi_rx_sysex_end(void) {
 //
 // SYSTEM REALTIME MESSAGES
 //
+// the clock and reset outputs are driven from the ISR by event_rx_realtime()
+// and the ISR also echoes these bytes ahead of any queued output
 // timing tick
 void _midi_rx_timing_tick(void) {
-	if(clock_enabled) {
-		clock_count ++;
-		// divide down the clock or pulse if we are on a starting pulse
-		if(clock_count >= clock_div || start_arm) {
-			// pulse the output
-			ioctl_set_clock_out(CLOCK_OUT_LEN);
-			ioctl_set_clock_led(CLOCK_LED_LEN, 0);
-			clock_count = 0;
-			start_arm = 0;
-		}
-	}
-	// echo and blink
-	_midi_tx_timing_tick();
+	// blink
 	event_blink_in();
 }
 
 // start song
 void _midi_rx_start_song(void) {
-	// reset pulses
-	ioctl_set_reset_out(RESET_OUT_LEN);
-	ioctl_set_reset_led(RESET_LED_LEN, 0);
-	clock_enabled = 1;
-	clock_count = 0;
-	start_arm = 1;  // cause the next tick to make a pulse
-	// echo and blink
-	_midi_tx_start_song();
+	// blink
 	event_blink_in();
 }
 
 // continue song
 void _midi_rx_continue_song(void) {
-	clock_enabled = 1;
-	// echo and blink
-	_midi_tx_continue_song();
+	// blink
 	event_blink_in();
 }
 
 // stop song
 void _midi_rx_stop_song(void) {
-	clock_enabled = 0;
-	// echo and blink
-	_midi_tx_stop_song();
+	// blink
 	event_blink_in();
 }
 
+// active sensing
+void _midi_rx_active_sensing(void) {
+	// start watching for the sender to go away
+	sense_armed = 1;
+	sense_count = 0;
+}
+
 // system reset
 void _midi_rx_system_reset(void) {
-	// this resets CV/gate outputs
-	voice_state_reset();
-	// reset all trigger and clock outputs
-	ioctl_set_trig1_out(0);
-	ioctl_set_trig2_out(0);
-	ioctl_set_trig3_out(0);
-	ioctl_set_trig4_out(0);
-	ioctl_set_clock_out(0);
-	ioctl_set_reset_out(0);
+	event_release_all();
 	// echo system reset
-	_midi_tx_system_reset();
+	if(midi_get_thru_mode() == MIDI_THRU_ECHO) _midi_tx_system_reset();
 	event_blink_in();
 }
 
@@ -782,7 +665,7 @@ void _midi_rx_key_pressure(unsigned char channel,
 		unsigned char pressure) {
 	// key pressure is not supported
 	// echo and blink
-	_midi_tx_key_pressure(channel, note, pressure);
+	if(midi_thru_echo(MIDI_THRU_PRESSURE, channel)) _midi_tx_key_pressure(channel, note, pressure);
 	event_blink_in();
 }
 
@@ -791,7 +674,7 @@ void _midi_rx_channel_pressure(unsigned char channel,
 		unsigned char pressure) {
 	// channel pressure is not supported
 	// echo and blink
-	_midi_tx_channel_pressure(channel, pressure);
+	if(midi_thru_echo(MIDI_THRU_PRESSURE, channel)) _midi_tx_channel_pressure(channel, pressure);
 	event_blink_in();
 }
 
@@ -799,87 +682,161 @@ void _midi_rx_channel_pressure(unsigned char channel,
 void _midi_rx_song_select(unsigned char song) {
 	// song select not supported
 	// echo and blink
-	_midi_tx_song_select(song);
+	if(midi_thru_echo(MIDI_THRU_CLOCK, MIDI_THRU_NO_CHAN)) _midi_tx_song_select(song);
 	event_blink_in();
 }
 
-// active sensing
-void _midi_rx_active_sensing(void) {
-	// active sensing not supported
-}
-
 // learn the MIDI channel
 void _midi_learn_channel(unsigned char channel) {
 	// we don't use this way of doing it
 }
 
+//
+// REALTIME
+//
+// song position - called from the ISR so it lands before the next clock
+void _midi_isr_song_position(unsigned int pos) {
+	unsigned char i, count, ticks;
+	// (pos * 6) % clock_div without the multiply and divide library calls
+	// - those are also used by the main code so the ISR can't call them
+	count = 0;
+	for(i = 0; i < 14; i ++) {
+		count <<= 1;
+		if(pos & 0x2000) count ++;
+		if(count >= clock_div) count -= clock_div;
+		pos <<= 1;
+	}
+	ticks = 0;
+	for(i = 0; i < 6; i ++) {
+		ticks += count;
+		if(ticks >= clock_div) ticks -= clock_div;
+	}
+	clock_count = ticks;
+	if(clock_count == 0) {
+		start_arm = 1;
+	}
+}
+
+// handle a realtime byte right away - called from the ISR
+void event_rx_realtime(unsigned char rx_byte) {
+	// timing tick
+	if(rx_byte == MIDI_TIMING_TICK) {
+		if(!clock_enabled) return;
+		clock_count ++;
+		// divide down the clock or pulse if we are on a starting pulse
+		if(clock_count >= clock_div || start_arm) {
+			// pulse the output
+			ioctl_isr_pulse_clock(CLOCK_OUT_LEN, CLOCK_LED_LEN);
+			clock_count = 0;
+			start_arm = 0;
+		}
+	}
+	// start song
+	else if(rx_byte == MIDI_START_SONG) {
+		// reset pulses
+		ioctl_isr_pulse_reset(RESET_OUT_LEN, RESET_LED_LEN);
+		clock_enabled = 1;
+		clock_count = 0;
+		start_arm = 1;  // cause the next tick to make a pulse
+	}
+	// continue song
+	else if(rx_byte == MIDI_CONTINUE_SONG) {
+		clock_enabled = 1;
+	}
+	// stop song
+	else if(rx_byte == MIDI_STOP_SONG) {
+		clock_enabled = 0;
+	}
+}
+
 //
 // CONFIG
 //
 // set a CV config
 void event_set_cv(unsigned char num, unsigned char map, 
 		unsigned char chan, unsigned char val) {
-	if(num > 1) return;
-	if(num == 1) {
-		cv2_map = map & 0x03;
-		cv2_chan = chan & 0x0f;
-		if(cv2_chan == 0x0f) cv2_chan = 0x00;
-		cv2_val = val & 0x7f;
-		config_store_set_val(CONFIG_CV2_MAP, cv2_map);
-		config_store_set_val(CONFIG_CV2_CHAN, cv2_chan);
-		config_store_set_val(CONFIG_CV2_VAL, cv2_val);
-	}
-	else {
-		cv1_map = map & 0x03;
-		cv1_chan = chan & 0x0f;
-		if(cv1_chan == 0x0f) cv1_chan = 0x00;
-		cv1_val = val & 0x7f;
-		config_store_set_val(CONFIG_CV1_MAP, cv1_map);
-		config_store_set_val(CONFIG_CV1_CHAN, cv1_chan);
-		config_store_set_val(CONFIG_CV1_VAL, cv1_val);
+	if(num >= IOCTL_CV_OUTS) return;
+	cv_map[num] = map & 0x03;
+	cv_chan[num] = chan & 0x0f;
+	if(cv_chan[num] == 0x0f) cv_chan[num] = 0x00;
+	cv_val[num] = val & 0x7f;
+	cv_msb[num] = 0;
+	cv_lsb_seen[num] = 0;
+	cv_msb_wait[num] = 0;
+	config_store_set_val(CONFIG_CV1_MAP + num, cv_map[num]);
+	config_store_set_val(CONFIG_CV1_CHAN + num, cv_chan[num]);
+	config_store_set_val(CONFIG_CV1_VAL + num, cv_val[num]);
+	event_cv_slew_apply(num);
+	event_route_build();
+}
+
+// set a CV slew time - 4ms steps - 0 = off
+void event_set_cv_slew(unsigned char num, unsigned char time) {
+	if(num >= IOCTL_CV_OUTS) return;
+	if(time > IOCTL_SLEW_MAX) time = 0;  // erased config
+	config_store_set_val(CONFIG_CV1_SLEW + num, time);
+	event_cv_slew_apply(num);
+}
+
+// pass the slew time on to a CV output - only CC mappings are slewed
+// notes, bends and direct control must land on the new value right away
+void event_cv_slew_apply(unsigned char num) {
+	if(cv_map[num] == EVENT_MAP_CC) {
+		ioctl_set_cv_slew(num, config_store_get_val(CONFIG_CV1_SLEW + num));
 	}
+	else ioctl_set_cv_slew(num, 0);
 }
 
 // set a TRIGGER config
 void event_set_trig(unsigned char num, unsigned char map,
 		unsigned char chan, unsigned char val) {
-	if(num > 3) return;
-	if(num == 3) {
-		trig4_map = map & 0x03;
-		trig4_chan = chan & 0x0f;
-		if(trig4_chan == 0x0f) trig4_chan = 0x00;
-		trig4_val = val & 0x7f;
-		config_store_set_val(CONFIG_TRIG4_MAP, trig4_map);
-		config_store_set_val(CONFIG_TRIG4_CHAN, trig4_chan);
-		config_store_set_val(CONFIG_TRIG4_VAL, trig4_val);
-	}
-	else if(num == 2) {
-		trig3_map = map & 0x03;
-		trig3_chan = chan & 0x0f;
-		if(trig3_chan == 0x0f) trig3_chan = 0x00;
-		trig3_val = val & 0x7f;
-		config_store_set_val(CONFIG_TRIG3_MAP, trig3_map);
-		config_store_set_val(CONFIG_TRIG3_CHAN, trig3_chan);
-		config_store_set_val(CONFIG_TRIG3_VAL, trig3_val);
-	}
-	else if(num == 1) {
-		trig2_map = map & 0x03;
-		trig2_chan = chan & 0x0f;
-		if(trig2_chan == 0x0f) trig2_chan = 0x00;
-		trig2_val = val & 0x7f;
-		config_store_set_val(CONFIG_TRIG2_MAP, trig2_map);
-		config_store_set_val(CONFIG_TRIG2_CHAN, trig2_chan);
-		config_store_set_val(CONFIG_TRIG2_VAL, trig2_val);
-	}
-	else {
-		trig1_map = map & 0x03;
-		trig1_chan = chan & 0x0f;
-		if(trig1_chan == 0x0f) trig1_chan = 0x00;
-		trig1_val = val & 0x7f;
-		config_store_set_val(CONFIG_TRIG1_MAP, trig1_map);
-		config_store_set_val(CONFIG_TRIG1_CHAN, trig1_chan);
-		config_store_set_val(CONFIG_TRIG1_VAL, trig1_val);
-	}
+	if(num >= IOCTL_TRIG_OUTS) return;
+	trig_map[num] = map & 0x03;
+	trig_chan[num] = chan & 0x0f;
+	if(trig_chan[num] == 0x0f) trig_chan[num] = 0x00;
+	trig_val[num] = val & 0x7f;
+	config_store_set_val(CONFIG_TRIG1_MAP + num, trig_map[num]);
+	config_store_set_val(CONFIG_TRIG1_CHAN + num, trig_chan[num]);
+	config_store_set_val(CONFIG_TRIG1_VAL + num, trig_val[num]);
+	// a note mapping starts out with just its own note in the bitmap
+	if(trig_map[num] == EVENT_MAP_NOTE) event_trig_notes_reset(num, trig_val[num]);
+	else event_trig_notes_reset(num, 0xff);
+	event_route_build();
+}
+
+// add or remove a note from a trigger's note bitmap
+void event_set_trig_note(unsigned char num, unsigned char note, unsigned char on) {
+	unsigned char pos;
+	if(num >= IOCTL_TRIG_OUTS) return;
+	note &= 0x7f;
+	pos = (num << 4) + (note >> 3);
+	if(on) trig_notes[pos] |= (1 << (note & 0x07));
+	else trig_notes[pos] &= ~(1 << (note & 0x07));
+	config_store_set_val(CONFIG_TRIG1_NOTES + pos, trig_notes[pos]);
+}
+
+// clear all notes from a trigger's note bitmap
+void event_clear_trig_notes(unsigned char num) {
+	if(num >= IOCTL_TRIG_OUTS) return;
+	event_trig_notes_reset(num, 0xff);
+}
+
+// set both CVs and gates directly - 12 bit CVs - gates bit 0 = GATE1, bit 1 = GATE2
+// ioctl writes the frame to both DACs and both gate pins in the same tick
+void event_set_direct(unsigned int cv1, unsigned int cv2, unsigned char gates) {
+	unsigned char i;
+	unsigned int cv;
+	for(i = 0; i < IOCTL_CV_OUTS; i ++) {
+		if(i) cv = cv2 & 0x0fff;
+		else cv = cv1 & 0x0fff;
+		// keep the CC direct control halves in step
+		cv_testh[i] = cv >> 5;
+		cv_testl[i] = (cv & 0x1f) << 2;
+		ioctl_set_cv_led(i, CV_LED_LEN, 0);
+		if(gates & (1 << i)) ioctl_set_gate_led(i, 255, 0);
+		else ioctl_set_gate_led(i, 0, 0);
+	}
+	ioctl_set_frame(cv1, cv2, gates);
 }
 
 // set the clock div
@@ -888,3 +845,90 @@ void event_set_clock_div(unsigned char div) {
 	if(clock_div > 48) clock_div = 48;
 	config_store_set_val(CONFIG_CLOCK_DIV, clock_div);
 }
+
+// set the thru mode - the mapper only echoes in MIDI_THRU_ECHO mode
+void event_set_thru_mode(unsigned char mode) {
+	if(mode != MIDI_THRU_CUT) mode = MIDI_THRU_ECHO;
+	midi_set_thru_mode(mode);
+	config_store_set_val(CONFIG_THRU_MODE, mode);
+}
+
+// set the thru filter - set bits block channels and MIDI_THRU_* message classes
+void event_set_thru_filter(unsigned int chan_block, unsigned char class_block) {
+	class_block &= 0x7f;
+	midi_set_thru_filter(chan_block, class_block);
+	config_store_set_val(CONFIG_THRU_CHAN_BLOCKL, chan_block & 0xff);
+	config_store_set_val(CONFIG_THRU_CHAN_BLOCKH, chan_block >> 8);
+	config_store_set_val(CONFIG_THRU_CLASS_BLOCK, class_block);
+}
+
+// set the output delay - 256us ticks - lines the chain up after a chain sync
+void event_set_output_delay(unsigned char ticks) {
+	if(ticks > IOCTL_OUT_DELAY_MAX) ticks = IOCTL_OUT_DELAY_MAX;
+	ioctl_set_output_delay(ticks);
+	config_store_set_val(CONFIG_OUTPUT_DELAY, ticks);
+}
+
+// rebuild the routing tables from the CV and trigger config
+void event_route_build(void) {
+	unsigned char i, bit;
+	for(i = 0; i < 16; i ++) {
+		route_note[i] = 0;
+		route_cc[i] = 0;
+		route_bend[i] = 0;
+	}
+	// CV/gate in note mode also takes bend, damper and legato CCs
+	bit = ROUTE_CV1;
+	for(i = 0; i < IOCTL_CV_OUTS; i ++) {
+		event_route_add(cv_map[i], cv_chan[i], bit);
+		if(cv_map[i] == EVENT_MAP_NOTE) {
+			event_route_add(EVENT_MAP_CC, cv_chan[i], bit);
+			event_route_add(EVENT_MAP_PITCH_BEND, cv_chan[i], bit);
+		}
+		bit <<= 1;
+	}
+	for(i = 0; i < IOCTL_TRIG_OUTS; i ++) {
+		event_route_add(trig_map[i], trig_chan[i], bit);
+		bit <<= 1;
+	}
+}
+
+// load the trigger note bitmaps from the config
+void event_trig_notes_build(void) {
+	unsigned char i, num;
+	for(i = 0; i < (IOCTL_TRIG_OUTS << 4); i ++) {
+		trig_notes[i] = config_store_get_val(CONFIG_TRIG1_NOTES + i);
+	}
+	// config from before the bitmaps existed - seed them from the trigger notes
+	if(config_store_get_val(CONFIG_TRIG_NOTES_TOKEN) != 0x00) {
+		config_store_set_val(CONFIG_TRIG_NOTES_TOKEN, 0x00);
+		for(num = 0; num < IOCTL_TRIG_OUTS; num ++) {
+			if(trig_map[num] == EVENT_MAP_NOTE) event_trig_notes_reset(num, trig_val[num]);
+			else event_trig_notes_reset(num, 0xff);
+		}
+	}
+}
+
+// set a trigger's note bitmap to a single note - 0xff = no notes
+// only the bytes that change are written
+void event_trig_notes_reset(unsigned char num, unsigned char note) {
+	unsigned char i, pos, bits;
+	pos = num << 4;
+	for(i = 0; i < 16; i ++) {
+		bits = 0;
+		if(note < 128 && (note >> 3) == i) bits = 1 << (note & 0x07);
+		if(trig_notes[pos] != bits) {
+			trig_notes[pos] = bits;
+			config_store_set_val(CONFIG_TRIG1_NOTES + pos, bits);
+		}
+		pos ++;
+	}
+}
+
+// add an output to the routing table for its mapping
+void event_route_add(unsigned char map, unsigned char chan, unsigned char route) {
+	if(chan > 15) return;
+	if(map == EVENT_MAP_NOTE) route_note[chan] |= route;
+	else if(map == EVENT_MAP_CC) route_cc[chan] |= route;
+	else if(map == EVENT_MAP_PITCH_BEND) route_bend[chan] |= route;
+}
@@ -12,11 +12,38 @@
 // init the event mapper
 void event_init(void);
 
+// run the event timer task
+void event_timer_task(void);
+
 // set a CV config
 void event_set_cv(unsigned char num, unsigned char map, unsigned char chan, unsigned char val);
 
+// set a CV slew time - only used while the CV is mapped to a CC
+void event_set_cv_slew(unsigned char num, unsigned char time);
+
 // set a trigger config
 void event_set_trig(unsigned char num, unsigned char map, unsigned char chan, unsigned char val);
 
+// add or remove a note from a trigger's note bitmap
+void event_set_trig_note(unsigned char num, unsigned char note, unsigned char on);
+
+// clear all notes from a trigger's note bitmap
+void event_clear_trig_notes(unsigned char num);
+
+// set both CVs and gates directly in one update
+void event_set_direct(unsigned int cv1, unsigned int cv2, unsigned char gates);
+
 // set the clock div
 void event_set_clock_div(unsigned char div);
+
+// set the thru mode
+void event_set_thru_mode(unsigned char mode);
+
+// set the thru filter
+void event_set_thru_filter(unsigned int chan_block, unsigned char class_block);
+
+// set the output delay
+void event_set_output_delay(unsigned char ticks);
+
+// handle a realtime byte right away - called from the ISR
+void event_rx_realtime(unsigned char rx_byte);
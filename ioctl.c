@@ -70,6 +70,36 @@
 
 #define LED_BLANK 6
 
+// GATE1-2 and TRIG1-4 - counters and LEDs are indexed in this order
+#define PULSE_GATE1 0
+#define PULSE_TRIG1 2
+#define PULSE_OUTS 6
+#define LED_GATE1 2
+#define LED_TRIG1 4
+// portd bit for each pulse output - GATE1_OUT to TRIG4_OUT
+rom unsigned char *pulse_out_bit = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20};
+
+// delayed outputs - scheduled writes are applied in order
+#define OUT_CV1 0
+#define OUT_CV2 1
+#define OUT_GATE1 2
+#define OUT_GATE2 3
+#define OUT_TRIG1 4
+#define OUT_TRIG2 5
+#define OUT_TRIG3 6
+#define OUT_TRIG4 7
+#define OUT_FRAME_CV1 8  // direct frame CV1 - held in frame_cv until OUT_FRAME
+#define OUT_FRAME_CV2 9  // direct frame CV2 - held in frame_cv until OUT_FRAME
+#define OUT_FRAME 10  // direct frame gates - writes both CVs and gates
+#define OUT_CV1_EXACT 11  // CV1 with no slew
+#define OUT_CV2_EXACT 12  // CV2 with no slew
+// writes are at most IOCTL_OUT_DELAY_MAX ticks ahead and a message comes at
+// most every 4 ticks at full wire rate - 8 messages of up to 4 writes each
+// a bigger burst applies the oldest writes early - the order is kept
+#define OUT_Q_SIZE 32  // must be a power of 2
+#define OUT_Q_VAL 0x0fff  // value bits of a scheduled write - output is above
+#define OUT_Q_MASK (OUT_Q_SIZE - 1)
+
 // local variables
 unsigned int dac0_val;				// current DAC0 value
 unsigned int dac1_val;				// current DAC1 value
@@ -83,19 +113,34 @@ unsigned char led_on_time[12];		// LED on time
 unsigned char led_off_time[12];		// LED off time
 unsigned char led_phase;			// which LED to control this time
 unsigned char led_blank;			// blanking counter
-unsigned char gate1_out_count;		// GATE1 out counter
-unsigned char gate2_out_count;		// GATE1 out counter
-unsigned char trig1_out_count;		// TRIG1 out counter
-unsigned char trig2_out_count;		// TRIG2 out counter
-unsigned char trig3_out_count;		// TRIG3 out counter
-unsigned char trig4_out_count;		// TRIG4 out counter
+unsigned char pulse_out_count[PULSE_OUTS];	// GATE1-2 and TRIG1-4 out counters
 unsigned char reset_out_count;		// reset out counter
 unsigned char clock_out_count;		// clock out counter
+unsigned char cv_slew[IOCTL_CV_OUTS];		// CV slew time - 4ms steps - 0 = off
+unsigned int cv_slew_count[IOCTL_CV_OUTS];	// CV slew - DAC updates left
+unsigned long cv_slew_pos[IOCTL_CV_OUTS];	// CV slew - current value - 12.12 fixed point
+unsigned long cv_slew_end[IOCTL_CV_OUTS];	// CV slew - target value - 12.12 fixed point
+signed long cv_slew_step[IOCTL_CV_OUTS];	// CV slew - change per DAC update - 12.12 fixed point
+unsigned char out_delay;			// output delay - 256us ticks - 0 = write right away
+unsigned char out_tick;				// 256us tick count for scheduled writes
+unsigned int out_q_val[OUT_Q_SIZE];		// scheduled write - output << 12 | value
+unsigned char out_q_due[OUT_Q_SIZE];	// scheduled write - tick it is due on
+unsigned char out_q_in_pos;			// next scheduled write slot
+unsigned char out_q_out_pos;		// next scheduled write to apply
+unsigned int frame_cv[IOCTL_CV_OUTS];	// direct frame - CV values
 
 // local functions
 void ioctl_spi_send(unsigned char);
 void ioctl_led_blink(void);
 void ioctl_pulse_out(void);
+void ioctl_out_sched(unsigned char out, unsigned int val);
+void ioctl_out_apply(void);
+void ioctl_out_commit(unsigned char out, unsigned int val);
+void ioctl_cv_commit(unsigned char num, unsigned int val);
+void ioctl_cv_jump(unsigned char num, unsigned int val);
+void ioctl_cv_slew(unsigned char num);
+void ioctl_frame_apply(unsigned char gates);
+void ioctl_dac_write(unsigned char num, unsigned int val);
 
 // init the stuff
 void ioctl_init(void) {
@@ -147,50 +192,56 @@ void ioctl_init(void) {
 	led_phase = 0;
 	led_blank = 0;
 
-	gate1_out_count = 0;
-	gate2_out_count = 0;
-	trig1_out_count = 0;
-	trig2_out_count = 0;
-	trig3_out_count = 0;
-	trig4_out_count = 0;
+	for(i = 0; i < PULSE_OUTS; i ++) {
+		pulse_out_count[i] = 0;
+	}
 	reset_out_count = 0;
 	clock_out_count = 0;
+
+	for(i = 0; i < IOCTL_CV_OUTS; i ++) {
+		cv_slew[i] = 0;
+		cv_slew_count[i] = 0;
+		cv_slew_pos[i] = (unsigned long)2048 << 12;
+		cv_slew_end[i] = cv_slew_pos[i];
+		cv_slew_step[i] = 0;
+	}
+
+	out_delay = 0;
+	out_tick = 0;
+	out_q_in_pos = 0;
+	out_q_out_pos = 0;
 }
 
 // runs the task on a timer - every 256uS
 void ioctl_timer_task(void) {
+	// apply scheduled writes that are due
+	out_tick ++;
+	while(out_q_out_pos != out_q_in_pos &&
+			(unsigned char)(out_tick - out_q_due[out_q_out_pos]) < 128) {
+		ioctl_out_apply();
+	}
 
-	// do DACs
+	// do DACs - each DAC is updated every 512us
 	if(task_phase & 0x01) {
+		if(cv_slew_count[1]) ioctl_cv_slew(1);
 		if(test_active) {
 			dac1_val_new = 0;
 			dac1_val = 1;  // force an update
 		}
 		if(dac1_val != dac1_val_new) {
 			dac1_val = dac1_val_new;
-			DAC_CS = 0;
-	//		delay_us(30);
-			ioctl_spi_send(0xb0 | ((dac1_val >> 8) & 0x0f));
-			delay_us(30);
-			ioctl_spi_send(dac1_val & 0xff);
-			delay_us(30);
-			DAC_CS = 1;
+			ioctl_dac_write(1, dac1_val);
 		}
 	}
 	else {
+		if(cv_slew_count[0]) ioctl_cv_slew(0);
 		if(test_active) {
 			dac0_val_new = 0;
 			dac0_val = 1;  // force an update
 		}
 		if(dac0_val != dac0_val_new) {
 			dac0_val = dac0_val_new;
-			DAC_CS = 0;
-	//		delay_us(30);
-			ioctl_spi_send(0x30 | ((dac0_val >> 8) & 0x0f));
-			delay_us(30);
-			ioctl_spi_send(dac0_val & 0xff);
-			delay_us(30);
-			DAC_CS = 1;
+			ioctl_dac_write(0, dac0_val);
 		}
 	}
 	ioctl_led_blink();
@@ -203,12 +254,40 @@ void ioctl_timer_task(void) {
 
 // set the CV1 output value
 void ioctl_set_cv1_out(unsigned int val) {
-	dac0_val_new = val;
+	if(out_delay) {
+		ioctl_out_sched(OUT_CV1, val);
+		return;
+	}
+	ioctl_cv_commit(0, val);
 }
 
 // set the CV2 output value
 void ioctl_set_cv2_out(unsigned int val) {
-	dac1_val_new = val;
+	if(out_delay) {
+		ioctl_out_sched(OUT_CV2, val);
+		return;
+	}
+	ioctl_cv_commit(1, val);
+}
+
+// set a CV output value by number
+void ioctl_set_cv_out(unsigned char num, unsigned int val) {
+	if(num >= IOCTL_CV_OUTS) return;
+	if(out_delay) {
+		ioctl_out_sched(OUT_CV1 + num, val);
+		return;
+	}
+	ioctl_cv_commit(num, val);
+}
+
+// set a CV output value by number with no slew
+void ioctl_set_cv_exact(unsigned char num, unsigned int val) {
+	if(num >= IOCTL_CV_OUTS) return;
+	if(out_delay) {
+		ioctl_out_sched(OUT_CV1_EXACT + num, val);
+		return;
+	}
+	ioctl_cv_jump(num, val);
 }
 
 // set the CV1 LED
@@ -277,18 +356,22 @@ void ioctl_set_trig4_led(unsigned char on, unsigned char off) {
 
 // set the reset LED
 void ioctl_set_reset_led(unsigned char on, unsigned char off) {
+	intcon.GIE = 0;  // the ISR pulses this LED
 	led_on_time[8] = on;
 	led_off_time[8] = off;
 	led_on_count[8] = on;
 	led_off_count[8] = off;
+	intcon.GIE = 1;
 }
 
 // set the clock LED
 void ioctl_set_clock_led(unsigned char on, unsigned char off) {
+	intcon.GIE = 0;  // the ISR pulses this LED
 	led_on_time[9] = on;
 	led_off_time[9] = off;
 	led_on_count[9] = on;
 	led_off_count[9] = off;
+	intcon.GIE = 1;
 }
 
 // set the MIDI in LED
@@ -307,6 +390,34 @@ void ioctl_set_midi_out_led(unsigned char on, unsigned char off) {
 	led_off_count[11] = off;
 }
 
+// set a CV LED by number
+void ioctl_set_cv_led(unsigned char num, unsigned char on, unsigned char off) {
+	if(num >= IOCTL_CV_OUTS) return;
+	led_on_time[num] = on;
+	led_off_time[num] = off;
+	led_on_count[num] = on;
+	led_off_count[num] = off;
+}
+
+// set a GATE LED by number
+void ioctl_set_gate_led(unsigned char num, unsigned char on, unsigned char off) {
+	if(num >= IOCTL_CV_OUTS) return;
+	num += LED_GATE1;
+	led_on_time[num] = on;
+	led_off_time[num] = off;
+	led_on_count[num] = on;
+	led_off_count[num] = off;
+}
+
+// set a TRIG LED by number
+void ioctl_set_trig_led(unsigned char num, unsigned char on, unsigned char off) {
+	if(num >= IOCTL_TRIG_OUTS) return;
+	num += LED_TRIG1;
+	led_on_time[num] = on;
+	led_off_time[num] = off;
+	led_on_count[num] = on;
+	led_off_count[num] = off;
+}
 
 // send a byte on the SPI bus and wait it to be sent
 void ioctl_spi_send(unsigned char data) {
@@ -317,6 +428,8 @@ void ioctl_spi_send(unsigned char data) {
 
 // handle LED blinking and timeouts
 void ioctl_led_blink(void) {
+	// the ISR pulses the reset and clock LEDs
+	if(led_phase == 8 || led_phase == 9) intcon.GIE = 0;
 	if(led_blank == 0) {
 		if(led_on_count[led_phase]) {
 			if(led_phase == 0) CV1_LED = 1;
@@ -372,6 +485,7 @@ void ioctl_led_blink(void) {
 		else if(led_phase == 10) MIDI_IN_LED = 0;
 		else if(led_phase == 11) MIDI_OUT_LED = 0;
 	}
+	if(led_phase == 8 || led_phase == 9) intcon.GIE = 1;
 	led_phase ++;
 	if(led_phase == 12) {
 		led_phase = 0;
@@ -384,48 +498,50 @@ void ioctl_led_blink(void) {
 
 // control the pulse outputs
 void ioctl_pulse_out(void) {
-	if(gate1_out_count) {
+	if(pulse_out_count[0]) {
 		GATE1_OUT = 1;
-		if(gate1_out_count != 255) gate1_out_count --;
+		if(pulse_out_count[0] != 255) pulse_out_count[0] --;
 	}
 	else {
 		GATE1_OUT = 0;
 	}
-	if(gate2_out_count) {
+	if(pulse_out_count[1]) {
 		GATE2_OUT = 1;
-		if(gate2_out_count != 255) gate2_out_count --;
+		if(pulse_out_count[1] != 255) pulse_out_count[1] --;
 	}
 	else {
 		GATE2_OUT = 0;
 	}
-	if(trig1_out_count) {
+	if(pulse_out_count[2]) {
 		TRIG1_OUT = 1;
-		if(trig1_out_count != 255) trig1_out_count --;
+		if(pulse_out_count[2] != 255) pulse_out_count[2] --;
 	}
 	else {
 		TRIG1_OUT = 0;
 	}
-	if(trig2_out_count) {
+	if(pulse_out_count[3]) {
 		TRIG2_OUT = 1;
-		if(trig2_out_count != 255) trig2_out_count --;
+		if(pulse_out_count[3] != 255) pulse_out_count[3] --;
 	}
 	else {
 		TRIG2_OUT = 0;
 	}
-	if(trig3_out_count) {
+	if(pulse_out_count[4]) {
 		TRIG3_OUT = 1;
-		if(trig3_out_count != 255) trig3_out_count --;
+		if(pulse_out_count[4] != 255) pulse_out_count[4] --;
 	}
 	else {
 		TRIG3_OUT = 0;
 	}
-	if(trig4_out_count) {
+	if(pulse_out_count[5]) {
 		TRIG4_OUT = 1;
-		if(trig4_out_count != 255) trig4_out_count --;
+		if(pulse_out_count[5] != 255) pulse_out_count[5] --;
 	}
 	else {
 		TRIG4_OUT = 0;
 	}
+	// the ISR can start a reset or clock pulse at any time
+	intcon.GIE = 0;
 	if(reset_out_count) {
 		RESET_OUT = 1;
 		if(reset_out_count != 255) reset_out_count --;
@@ -440,52 +556,282 @@ void ioctl_pulse_out(void) {
 	else {
 		CLOCK_OUT = 0;
 	}
+	intcon.GIE = 1;
 }
 
 // set the GATE1 out
 void ioctl_set_gate1_out(unsigned char val) {
-	gate1_out_count = val;
+	if(out_delay) {
+		ioctl_out_sched(OUT_GATE1, val);
+		return;
+	}
+	pulse_out_count[0] = val;
 }
 
 // set the GATE2 out
 void ioctl_set_gate2_out(unsigned char val) {
-	gate2_out_count = val;
+	if(out_delay) {
+		ioctl_out_sched(OUT_GATE2, val);
+		return;
+	}
+	pulse_out_count[1] = val;
 }
 
 // set the TRIG1 out
 void ioctl_set_trig1_out(unsigned char val) {
+	if(out_delay) {
+		ioctl_out_sched(OUT_TRIG1, val);
+		return;
+	}
 	if(val) TRIG1_OUT = 1;
-	trig1_out_count = val;
+	pulse_out_count[2] = val;
 }
 
 // set the TRIG2 out
 void ioctl_set_trig2_out(unsigned char val) {
+	if(out_delay) {
+		ioctl_out_sched(OUT_TRIG2, val);
+		return;
+	}
 	if(val) TRIG2_OUT = 1;
-	trig2_out_count = val;
+	pulse_out_count[3] = val;
 }
 
 // set the TRIG3 out
 void ioctl_set_trig3_out(unsigned char val) {
+	if(out_delay) {
+		ioctl_out_sched(OUT_TRIG3, val);
+		return;
+	}
 	if(val) TRIG3_OUT = 1;
-	trig3_out_count = val;
+	pulse_out_count[4] = val;
 }
 
 // set the TRIG4 out
 void ioctl_set_trig4_out(unsigned char val) {
+	if(out_delay) {
+		ioctl_out_sched(OUT_TRIG4, val);
+		return;
+	}
 	if(val) TRIG4_OUT = 1;
-	trig4_out_count = val;
+	pulse_out_count[5] = val;
+}
+
+// set a GATE out by number
+void ioctl_set_gate_out(unsigned char num, unsigned char val) {
+	if(num >= IOCTL_CV_OUTS) return;
+	if(out_delay) {
+		ioctl_out_sched(OUT_GATE1 + num, val);
+		return;
+	}
+	pulse_out_count[PULSE_GATE1 + num] = val;
+}
+
+// set a TRIG out by number
+void ioctl_set_trig_out(unsigned char num, unsigned char val) {
+	if(num >= IOCTL_TRIG_OUTS) return;
+	if(out_delay) {
+		ioctl_out_sched(OUT_TRIG1 + num, val);
+		return;
+	}
+	num += PULSE_TRIG1;
+	if(val) portd |= pulse_out_bit[num];
+	pulse_out_count[num] = val;
 }
 
 // set the reset out
 void ioctl_set_reset_out(unsigned char val) {
+	intcon.GIE = 0;  // the ISR pulses this output
 	if(val) RESET_OUT = 1;
 	reset_out_count = val;
+	intcon.GIE = 1;
 }
 
 // set the clock out
 void ioctl_set_clock_out(unsigned char val) {
+	intcon.GIE = 0;  // the ISR pulses this output
 	if(val) CLOCK_OUT = 1;
 	clock_out_count = val;
+	intcon.GIE = 1;
+}
+
+// set the CV slew time - 4ms steps - 0 = off
+void ioctl_set_cv_slew(unsigned char num, unsigned char time) {
+	if(num >= IOCTL_CV_OUTS) return;
+	if(time > IOCTL_SLEW_MAX) time = IOCTL_SLEW_MAX;
+	cv_slew[num] = time;
+}
+
+// set a new CV value - ramps to it if slew is on for the output
+void ioctl_cv_commit(unsigned char num, unsigned int val) {
+	unsigned long end;
+	// a bent note can go past either end of the DAC range
+	if(val > 0x0fff) {
+		if(val & 0x8000) val = 0;
+		else val = 0x0fff;
+	}
+	// no slew - jump straight there
+	if(cv_slew[num] == 0) {
+		ioctl_cv_jump(num, val);
+		return;
+	}
+	end = (unsigned long)val << 12;
+	// same target - the ramp already running gets there
+	if(end == cv_slew_end[num]) return;
+	cv_slew_end[num] = end;
+	// 8 DAC updates per 4ms - ramp from wherever we are now
+	cv_slew_count[num] = (unsigned int)cv_slew[num] << 3;
+	if(end >= cv_slew_pos[num]) {
+		cv_slew_step[num] = (end - cv_slew_pos[num]) / cv_slew_count[num];
+	}
+	else {
+		cv_slew_step[num] = -(signed long)((cv_slew_pos[num] - end) / 
+			cv_slew_count[num]);
+	}
+}
+
+// set a new 12 bit CV value with no slew - a running ramp is stopped
+void ioctl_cv_jump(unsigned char num, unsigned int val) {
+	cv_slew_end[num] = (unsigned long)val << 12;
+	cv_slew_count[num] = 0;
+	cv_slew_pos[num] = cv_slew_end[num];
+	if(num) dac1_val_new = val;
+	else dac0_val_new = val;
+}
+
+// set both CVs and gates as one frame - gates bit 0 = GATE1, bit 1 = GATE2
+// both DACs and both gate pins are written back to back in the same tick
+void ioctl_set_frame(unsigned int cv1, unsigned int cv2, unsigned char gates) {
+	// each frame is queued with its own values - the CVs are held until the gates
+	if(out_delay) {
+		ioctl_out_sched(OUT_FRAME_CV1, cv1 & 0x0fff);
+		ioctl_out_sched(OUT_FRAME_CV2, cv2 & 0x0fff);
+		ioctl_out_sched(OUT_FRAME, gates);
+		return;
+	}
+	frame_cv[0] = cv1 & 0x0fff;
+	frame_cv[1] = cv2 & 0x0fff;
+	ioctl_frame_apply(gates);
+}
+
+// write the direct frame to the DACs and gate pins - slew is skipped
+void ioctl_frame_apply(unsigned char gates) {
+	unsigned char i;
+	for(i = 0; i < IOCTL_CV_OUTS; i ++) {
+		cv_slew_count[i] = 0;
+		cv_slew_pos[i] = (unsigned long)frame_cv[i] << 12;
+		cv_slew_end[i] = cv_slew_pos[i];
+	}
+	dac0_val = frame_cv[0];
+	dac0_val_new = dac0_val;
+	dac1_val = frame_cv[1];
+	dac1_val_new = dac1_val;
+	ioctl_dac_write(0, dac0_val);
+	ioctl_dac_write(1, dac1_val);
+	// the pins are set now - the counters keep them there
+	if(gates & 0x01) {
+		pulse_out_count[0] = 255;
+		GATE1_OUT = 1;
+	}
+	else {
+		pulse_out_count[0] = 0;
+		GATE1_OUT = 0;
+	}
+	if(gates & 0x02) {
+		pulse_out_count[1] = 255;
+		GATE2_OUT = 1;
+	}
+	else {
+		pulse_out_count[1] = 0;
+		GATE2_OUT = 0;
+	}
+}
+
+// write a value to a DAC channel - 0 = DAC0, 1 = DAC1
+void ioctl_dac_write(unsigned char num, unsigned int val) {
+	DAC_CS = 0;
+	if(num) ioctl_spi_send(0xb0 | ((val >> 8) & 0x0f));
+	else ioctl_spi_send(0x30 | ((val >> 8) & 0x0f));
+	delay_us(30);
+	ioctl_spi_send(val & 0xff);
+	delay_us(30);
+	DAC_CS = 1;
+}
+
+// step a CV slew - called for each DAC update while a slew is running
+void ioctl_cv_slew(unsigned char num) {
+	unsigned int val;
+	cv_slew_count[num] --;
+	if(cv_slew_count[num] == 0) cv_slew_pos[num] = cv_slew_end[num];
+	else cv_slew_pos[num] += cv_slew_step[num];
+	val = cv_slew_pos[num] >> 12;
+	if(num) dac1_val_new = val;
+	else dac0_val_new = val;
+}
+
+// set the output delay - 256us ticks - writes already scheduled are applied now
+void ioctl_set_output_delay(unsigned char ticks) {
+	while(out_q_out_pos != out_q_in_pos) {
+		ioctl_out_apply();
+	}
+	out_delay = ticks;
+}
+
+// schedule an output write for out_delay ticks from now
+void ioctl_out_sched(unsigned char out, unsigned int val) {
+	unsigned char next = (out_q_in_pos + 1) & OUT_Q_MASK;
+	// full - apply the oldest write early so the order is kept
+	if(next == out_q_out_pos) ioctl_out_apply();
+	// keep the value out of the output bits - a bent note can go past the DAC range
+	if(val > OUT_Q_VAL) {
+		if(val & 0x8000) val = 0;
+		else val = OUT_Q_VAL;
+	}
+	out_q_val[out_q_in_pos] = ((unsigned int)out << 12) | val;
+	out_q_due[out_q_in_pos] = out_tick + out_delay;
+	out_q_in_pos = next;
+}
+
+// apply the oldest scheduled write
+void ioctl_out_apply(void) {
+	unsigned int val = out_q_val[out_q_out_pos];
+	ioctl_out_commit(val >> 12, val & OUT_Q_VAL);
+	out_q_out_pos = (out_q_out_pos + 1) & OUT_Q_MASK;
+}
+
+// apply an output write
+void ioctl_out_commit(unsigned char out, unsigned int val) {
+	if(out == OUT_FRAME) ioctl_frame_apply(val);
+	else if(out == OUT_FRAME_CV1) frame_cv[0] = val;
+	else if(out == OUT_FRAME_CV2) frame_cv[1] = val;
+	else if(out >= OUT_CV1_EXACT) ioctl_cv_jump(out - OUT_CV1_EXACT, val);
+	else if(out <= OUT_CV2) ioctl_cv_commit(out - OUT_CV1, val);
+	// GATE1-2 and TRIG1-4 are in pulse output order
+	else {
+		out -= OUT_GATE1;
+		if(val && out >= PULSE_TRIG1) portd |= pulse_out_bit[out];
+		pulse_out_count[out] = val;
+	}
+}
+
+// pulse the clock out and LED - called from the ISR
+void ioctl_isr_pulse_clock(unsigned char out, unsigned char led) {
+	CLOCK_OUT = 1;
+	clock_out_count = out;
+	led_on_time[9] = led;
+	led_off_time[9] = 0;
+	led_on_count[9] = led;
+	led_off_count[9] = 0;
+}
+
+// pulse the reset out and LED - called from the ISR
+void ioctl_isr_pulse_reset(unsigned char out, unsigned char led) {
+	RESET_OUT = 1;
+	reset_out_count = out;
+	led_on_time[8] = led;
+	led_off_time[8] = 0;
+	led_on_count[8] = led;
+	led_off_count[8] = 0;
 }
 
 // gets the state of the setup switch
@@ -10,6 +10,13 @@
 #define CV_TEST_VAL 1632
 // 0.000V - zero val
 #define CV_ZERO_VAL 2040
+// max output delay - 256us ticks - about 8ms, what the output queue holds
+#define IOCTL_OUT_DELAY_MAX 31
+// number of CV/gate and trigger outputs
+#define IOCTL_CV_OUTS 2
+#define IOCTL_TRIG_OUTS 4
+// max CV slew time - 4ms steps
+#define IOCTL_SLEW_MAX 127
 
 // init the stuff
 void ioctl_init(void);
@@ -23,6 +30,12 @@ void ioctl_set_cv1_out(unsigned int);
 // set the CV2 output value
 void ioctl_set_cv2_out(unsigned int);
 
+// set a CV output value by number
+void ioctl_set_cv_out(unsigned char num, unsigned int val);
+
+// set a CV output value by number with no slew - for direct control
+void ioctl_set_cv_exact(unsigned char num, unsigned int val);
+
 // set the CV1 LED - on time, off time (for repeat or 0 for one-shot)
 void ioctl_set_cv1_led(unsigned char, unsigned char);
 
@@ -47,6 +60,15 @@ void ioctl_set_trig3_led(unsigned char, unsigned char);
 // set the TRIG4 LED - on time, off time (for repeat or 0 for one-shot)
 void ioctl_set_trig4_led(unsigned char, unsigned char);
 
+// set a CV LED by number - on time, off time (for repeat or 0 for one-shot)
+void ioctl_set_cv_led(unsigned char num, unsigned char on, unsigned char off);
+
+// set a GATE LED by number - on time, off time (for repeat or 0 for one-shot)
+void ioctl_set_gate_led(unsigned char num, unsigned char on, unsigned char off);
+
+// set a TRIG LED by number - on time, off time (for repeat or 0 for one-shot)
+void ioctl_set_trig_led(unsigned char num, unsigned char on, unsigned char off);
+
 // set the reset LED - on time, off time (for repeat or 0 for one-shot)
 void ioctl_set_reset_led(unsigned char, unsigned char);
 
@@ -77,12 +99,27 @@ void ioctl_set_trig3_out(unsigned char);
 // set the TRIG4 out - 0 = off, 1-254 = 1-254 * 1024us, 255 = latch on
 void ioctl_set_trig4_out(unsigned char);
 
+// set a GATE out by number - 0 = off, 1-254 = 1-254 * 1024us, 255 = latch on
+void ioctl_set_gate_out(unsigned char num, unsigned char val);
+
+// set a TRIG out by number - 0 = off, 1-254 = 1-254 * 1024us, 255 = latch on
+void ioctl_set_trig_out(unsigned char num, unsigned char val);
+
 // set the reset out - 0 = off, 1-254 = 1-254 * 1024us, 255 = latch on
 void ioctl_set_reset_out(unsigned char);
 
 // set the clock out - 0 = off, 1-254 = 1-254 * 1024us, 255 = latch on
 void ioctl_set_clock_out(unsigned char);
 
+// set both CVs and gates as one frame - 12 bit CVs - gates bit 0 = GATE1, bit 1 = GATE2
+void ioctl_set_frame(unsigned int cv1, unsigned int cv2, unsigned char gates);
+
+// set the CV slew time - 0 = off, 1-127 = 1-127 * 4ms to reach each new value
+void ioctl_set_cv_slew(unsigned char num, unsigned char time);
+
+// set the output delay for CV, gate and trigger writes - 0-31 * 256us
+void ioctl_set_output_delay(unsigned char ticks);
+
 // gets the state of the setup switch
 unsigned char ioctl_get_setup_sw(void);
 
@@ -91,3 +128,9 @@ unsigned char ioctl_get_select_sw(void);
 
 // sets the state of the TEST pin - 1 = assert test mode, 0 = high Z
 void ioctl_set_test_pin(unsigned char mode);
+
+// pulse the clock out and LED - called from the ISR
+void ioctl_isr_pulse_clock(unsigned char out, unsigned char led);
+
+// pulse the reset out and LED - called from the ISR
+void ioctl_isr_pulse_reset(unsigned char out, unsigned char led);
@@ -27,204 +27,324 @@
 #define MIDI_SYSEX_START 0xf0
 #define MIDI_SYSEX_END 0xf7
 
-// system realtime messages
-#define MIDI_TIMING_TICK 0xf8
-#define MIDI_START_SONG 0xfa
-#define MIDI_CONTINUE_SONG 0xfb
-#define MIDI_STOP_SONG 0xfc
-#define MIDI_ACTIVE_SENSING 0xfe
-#define MIDI_SYSTEM_RESET 0xff
+// message kinds - channel messages first, realtime messages last
+#define MIDI_KIND_NONE 0
+#define MIDI_KIND_NOTE_OFF 1
+#define MIDI_KIND_NOTE_ON 2
+#define MIDI_KIND_KEY_PRESSURE 3
+#define MIDI_KIND_CONTROL_CHANGE 4
+#define MIDI_KIND_PROG_CHANGE 5
+#define MIDI_KIND_CHAN_PRESSURE 6
+#define MIDI_KIND_PITCH_BEND 7
+#define MIDI_KIND_SONG_POSITION 8
+#define MIDI_KIND_SONG_SELECT 9
+#define MIDI_KIND_SYSEX_START 10
+#define MIDI_KIND_SYSEX_DATA 11
+#define MIDI_KIND_SYSEX_END 12
+#define MIDI_KIND_TIMING_TICK 13
+#define MIDI_KIND_START_SONG 14
+#define MIDI_KIND_CONTINUE_SONG 15
+#define MIDI_KIND_STOP_SONG 16
+#define MIDI_KIND_ACTIVE_SENSING 17
+#define MIDI_KIND_SYSTEM_RESET 18
+
+// status table entry - running status flag, data length and message kind
+#define MIDI_STAT_KIND 0x1f
+#define MIDI_STAT_LEN 0x60
+#define MIDI_STAT_LEN0 0x00
+#define MIDI_STAT_LEN1 0x20
+#define MIDI_STAT_LEN2 0x40
+#define MIDI_STAT_RUNNING 0x80
+
+// status classification table - kept in program memory
+// 0x00-0x0f - indexed by status >> 4 (only 0x08-0x0e are used)
+// 0x10-0x1f - indexed by system status - 0xe0
+rom unsigned char *midi_stat_table = {
+	MIDI_KIND_NONE, MIDI_KIND_NONE, MIDI_KIND_NONE, MIDI_KIND_NONE,
+	MIDI_KIND_NONE, MIDI_KIND_NONE, MIDI_KIND_NONE, MIDI_KIND_NONE,
+	MIDI_STAT_RUNNING | MIDI_STAT_LEN2 | MIDI_KIND_NOTE_OFF,  // 0x8n
+	MIDI_STAT_RUNNING | MIDI_STAT_LEN2 | MIDI_KIND_NOTE_ON,  // 0x9n
+	MIDI_STAT_RUNNING | MIDI_STAT_LEN2 | MIDI_KIND_KEY_PRESSURE,  // 0xan
+	MIDI_STAT_RUNNING | MIDI_STAT_LEN2 | MIDI_KIND_CONTROL_CHANGE,  // 0xbn
+	MIDI_STAT_RUNNING | MIDI_STAT_LEN1 | MIDI_KIND_PROG_CHANGE,  // 0xcn
+	MIDI_STAT_RUNNING | MIDI_STAT_LEN1 | MIDI_KIND_CHAN_PRESSURE,  // 0xdn
+	MIDI_STAT_RUNNING | MIDI_STAT_LEN2 | MIDI_KIND_PITCH_BEND,  // 0xen
+	MIDI_KIND_NONE,
+	MIDI_STAT_LEN0 | MIDI_KIND_SYSEX_START,  // 0xf0
+	MIDI_KIND_NONE,  // 0xf1 - MTC quarter frame not supported
+	MIDI_STAT_LEN2 | MIDI_KIND_SONG_POSITION,  // 0xf2
+	MIDI_STAT_LEN1 | MIDI_KIND_SONG_SELECT,  // 0xf3
+	MIDI_KIND_NONE, MIDI_KIND_NONE, MIDI_KIND_NONE,  // 0xf4-0xf6
+	MIDI_STAT_LEN0 | MIDI_KIND_SYSEX_END,  // 0xf7
+	MIDI_STAT_LEN0 | MIDI_KIND_TIMING_TICK,  // 0xf8
+	MIDI_KIND_NONE,  // 0xf9
+	MIDI_STAT_LEN0 | MIDI_KIND_START_SONG,  // 0xfa
+	MIDI_STAT_LEN0 | MIDI_KIND_CONTINUE_SONG,  // 0xfb
+	MIDI_STAT_LEN0 | MIDI_KIND_STOP_SONG,  // 0xfc
+	MIDI_KIND_NONE,  // 0xfd
+	MIDI_STAT_LEN0 | MIDI_KIND_ACTIVE_SENSING,  // 0xfe
+	MIDI_STAT_LEN0 | MIDI_KIND_SYSTEM_RESET  // 0xff
+};
+
+// thru filter class for each message kind - 0 = never filtered
+rom unsigned char *midi_kind_thru = {
+	0,  // MIDI_KIND_NONE
+	MIDI_THRU_NOTE,  // MIDI_KIND_NOTE_OFF
+	MIDI_THRU_NOTE,  // MIDI_KIND_NOTE_ON
+	MIDI_THRU_PRESSURE,  // MIDI_KIND_KEY_PRESSURE
+	MIDI_THRU_CC,  // MIDI_KIND_CONTROL_CHANGE
+	MIDI_THRU_PROGRAM,  // MIDI_KIND_PROG_CHANGE
+	MIDI_THRU_PRESSURE,  // MIDI_KIND_CHAN_PRESSURE
+	MIDI_THRU_BEND,  // MIDI_KIND_PITCH_BEND
+	MIDI_THRU_CLOCK,  // MIDI_KIND_SONG_POSITION
+	MIDI_THRU_CLOCK,  // MIDI_KIND_SONG_SELECT
+	MIDI_THRU_SYSEX,  // MIDI_KIND_SYSEX_START
+	MIDI_THRU_SYSEX,  // MIDI_KIND_SYSEX_DATA
+	MIDI_THRU_SYSEX,  // MIDI_KIND_SYSEX_END
+	MIDI_THRU_CLOCK,  // MIDI_KIND_TIMING_TICK
+	MIDI_THRU_CLOCK,  // MIDI_KIND_START_SONG
+	MIDI_THRU_CLOCK,  // MIDI_KIND_CONTINUE_SONG
+	MIDI_THRU_CLOCK,  // MIDI_KIND_STOP_SONG
+	0,  // MIDI_KIND_ACTIVE_SENSING
+	0  // MIDI_KIND_SYSTEM_RESET
+};
 
 // state
 #define RX_STATE_IDLE 0
 #define RX_STATE_DATA0 1
 #define RX_STATE_DATA1 2
 #define RX_STATE_SYSEX_DATA 3
-unsigned char rx_state;  // receiver state
+#define RX_SYSEX_EMPTY 0xff  // data1 of a sysex data record with one byte
 unsigned char midi_learn_mode;
+unsigned char midi_setup_mode;  // 1 = channel messages go to the setup callbacks
+
+// TX lane owning the wire - a message is never interleaved with another
+#define TX_OWNER_NONE 0
+#define TX_OWNER_FWD 1
+#define TX_OWNER_LOCAL 2
+#define TX_LEFT_SYSEX 0xff
 
-// RX message
+// RX parser - only used from the ISR
+unsigned char rx_state;  // receiver state
 unsigned char rx_status_chan;  // current message channel
-unsigned char rx_status;  // current status byte
+unsigned char rx_status;  // current status table entry
 unsigned char rx_data0;  // data0 byte
-unsigned char rx_data1;  // data1 byte
+unsigned int rx_msg_time;  // timestamp of the first byte of the current message
+unsigned char rx_msg_timed;  // 1 = rx_msg_time is set for the current message
 
-// RX buffer
-unsigned rx_msg[64];  // receive msg buffer
-unsigned rx_in_pos;
-unsigned rx_out_pos;
+// RX message queue - single producer (ISR) / single consumer (RX task)
+// each priority lane uses its own block of MIDI_RX_LANE_SIZE slots
+#define MIDI_RX_LANE_HIGH 0  // notes, damper, channel mode, system reset and realtime
+#define MIDI_RX_LANE_LOW 1  // controllers, pressure, bend, program, sysex and resets behind them
+#define MIDI_RX_LANES 2
+unsigned char rx_q_kind[MIDI_RX_LANES * MIDI_RX_LANE_SIZE];  // message kind
+unsigned char rx_q_chan[MIDI_RX_LANES * MIDI_RX_LANE_SIZE];  // channel - channel messages only
+unsigned char rx_q_data0[MIDI_RX_LANES * MIDI_RX_LANE_SIZE];  // data0 byte
+unsigned char rx_q_data1[MIDI_RX_LANES * MIDI_RX_LANE_SIZE];  // data1 byte
+unsigned int rx_q_time[MIDI_RX_LANES * MIDI_RX_LANE_SIZE];  // timestamp of the first byte
+unsigned char rx_in_pos[MIDI_RX_LANES];  // next slot to write - only changed by the ISR
+unsigned char rx_out_pos[MIDI_RX_LANES];  // next slot to read - only changed by the RX task
+// channel messages put in / taken out of the low lane per channel - they differ while any wait
+unsigned char rx_low_in[16];  // only changed by the ISR
+unsigned char rx_low_out[16];  // only changed by the RX task
+// system resets put in / taken out of the low lane - they differ while one waits
+unsigned char rx_reset_in;  // only changed by the ISR
+unsigned char rx_reset_out;  // only changed by the RX task
+unsigned int rx_stats[MIDI_RX_STATS];  // receive health counters
+unsigned char rx_drain_max;  // max messages handled per RX task call
+unsigned char rx_depth_pre;  // queue depth before the last drain
+unsigned char rx_depth_post;  // queue depth after the last drain
+unsigned int rx_cb_time;  // timestamp of the message being dispatched
+unsigned char rx_sysex_open;  // 1 = a sysex message is being dispatched - RX task only
+unsigned char rx_sysex_lost;  // 1 = a sysex record was dropped - set by the ISR
+unsigned int rx_hop_lat;  // smoothed time from a note arriving to its echo being queued - us
 
-// TX message
+// TX message - single producer (main) / single consumer (TX ISR)
 unsigned char tx_msg[256];  // transmit msg buffer
-unsigned char tx_in_pos;
-unsigned char tx_out_pos;
-#define TX_IN_POS tx_in_pos++
+unsigned char tx_in_pos;  // next slot to write - only changed by main
+unsigned char tx_out_pos;  // next slot to send - only changed by the ISR
+unsigned char tx_rt_msg[MIDI_TX_RT_SIZE];  // realtime lane - sent ahead of tx_msg
+unsigned char tx_rt_in_pos;  // next realtime slot to write
+unsigned char tx_rt_out_pos;  // next realtime slot to send - only changed by the ISR
+unsigned int tx_byte_count;  // bytes sent in the current rate window
+unsigned int tx_rate;  // bytes sent in the last rate window
+unsigned int tx_rate_ticks;  // timer task calls in the current rate window
+unsigned char tx_running_status;  // last channel status sent - 0 = none
+unsigned char tx_running_count;  // status bytes left out since it was last sent
+unsigned char tx_running_max;  // status bytes left out before resending - 0 = off
+unsigned char tx_reserve_left;  // bytes left of the last reservation
+unsigned char tx_thru_mode;  // MIDI_THRU_ECHO or MIDI_THRU_CUT
+unsigned int tx_thru_chan_block;  // thru filter - bit set = channel blocked
+unsigned char tx_thru_class_block;  // thru filter - MIDI_THRU_* bit set = class blocked
+unsigned char tx_fwd_block;  // 1 = the current received message is filtered
+unsigned char tx_fwd_msg[MIDI_TX_FWD_SIZE];  // cut-through lane - written by the RX ISR
+unsigned char tx_fwd_in_pos;  // next forward slot to write - only changed by the ISR
+unsigned char tx_fwd_out_pos;  // next forward slot to send - only changed by the ISR
+unsigned char tx_fwd_skip;  // 1 = dropping the rest of a forwarded message
+unsigned char tx_fwd_idle;  // timer task calls since the last forwarded byte
+// TX interleave state - only used by the ISR
+unsigned char tx_owner;  // lane part way through a message - TX_OWNER_NONE at a boundary
+unsigned char tx_last_owner;  // lane that sent the last complete message
+unsigned char tx_left;  // data bytes left in the message on the wire
+unsigned char tx_len;  // data bytes per message for the running status on the wire
+unsigned char tx_wire_status;  // channel status the next unit is running on - 0 = none
+unsigned char tx_fwd_status;  // channel status of the forwarded stream - 0 = none
+unsigned char tx_headroom;  // bytes kept free for normal messages
+unsigned int tx_stats[MIDI_TX_STATS];  // transmit drop counters
 
 // function prototypes
-void process_msg(void);
+void midi_rx_queue(unsigned char kind, unsigned char data0, 
+	unsigned char data1, unsigned int time);
+unsigned char midi_rx_cc_merge(unsigned char controller);
+unsigned char midi_rx_depth(void);
+void midi_tx_byte(unsigned char data);
+void midi_tx_rt_isr(unsigned char data);
+void midi_tx_rt_byte(unsigned char data);
+void midi_tx_fwd_isr(unsigned char data);
+void midi_tx_track(unsigned char data, unsigned char lane);
+void midi_tx_status(unsigned char stat);
+void process_msg(unsigned char slot);
 
 // init the MIDI receiver module
 void midi_init(void) {
+	unsigned char i;
 	rx_state = RX_STATE_IDLE;
 	rx_status = 0;  // no running status yet
  	rx_status_chan = 0;
+	rx_data0 = 0;
+	rx_msg_time = 0;
+	rx_msg_timed = 0;
+	rx_cb_time = 0;
 	tx_in_pos = 0;
 	tx_out_pos = 0;
-	rx_in_pos = 0;
-	rx_out_pos = 0;
+	tx_rt_in_pos = 0;
+	tx_rt_out_pos = 0;
+	tx_byte_count = 0;
+	tx_rate = 0;
+	tx_rate_ticks = 0;
+	tx_running_status = 0;
+	tx_running_count = 0;
+	tx_running_max = MIDI_TX_RUNNING_STATUS_MAX;
+	tx_reserve_left = 0;
+	tx_thru_mode = MIDI_THRU_ECHO;
+	tx_thru_chan_block = 0;
+	tx_thru_class_block = 0;
+	tx_fwd_block = 0;
+	tx_fwd_in_pos = 0;
+	tx_fwd_out_pos = 0;
+	tx_fwd_skip = 0;
+	tx_fwd_idle = 0;
+	tx_owner = TX_OWNER_NONE;
+	tx_last_owner = TX_OWNER_NONE;
+	tx_left = 0;
+	tx_len = 0;
+	tx_wire_status = 0;
+	tx_fwd_status = 0;
+	tx_headroom = MIDI_TX_CONTROL_HEADROOM;
+	for(i = 0; i < MIDI_TX_STATS; i ++) {
+		tx_stats[i] = 0;
+	}
+	for(i = 0; i < MIDI_RX_LANES; i ++) {
+		rx_in_pos[i] = 0;
+		rx_out_pos[i] = 0;
+	}
+	for(i = 0; i < MIDI_RX_STATS; i ++) {
+		rx_stats[i] = 0;
+	}
+	for(i = 0; i < 16; i ++) {
+		rx_low_in[i] = 0;
+		rx_low_out[i] = 0;
+	}
+	rx_reset_in = 0;
+	rx_reset_out = 0;
+	rx_drain_max = MIDI_RX_DRAIN_MAX;
+	rx_depth_pre = 0;
+	rx_depth_post = 0;
+	rx_sysex_open = 0;
+	rx_sysex_lost = 0;
+	rx_hop_lat = 0;
 	midi_learn_mode = 0;
+	midi_setup_mode = 0;
 }
 
-// handle a new byte received from the stream
-void midi_rx_byte(unsigned char rx_byte) {
-	rx_in_pos = (rx_in_pos + 1) & 0x3f;
-	rx_msg[rx_in_pos] = rx_byte;
-}
-
-// transmit task
-void midi_tx_task(void) {
-	if(!txsta.TRMT) return;  // BoostC
-	if(tx_in_pos == tx_out_pos) return;
-//	UARTSendDataByte(UART1, tx_msg[tx_out_pos++]);  // MCC18
-	txreg = tx_msg[tx_out_pos++];  // BoostC
-}
-
-// receive task
-void midi_rx_task(void) {
-	unsigned char stat, chan;
-	unsigned char rx_byte;
-	// turn off interrupts
-	intcon.GIE = 0;
-	// get data from RX buffer
-	if(rx_in_pos == rx_out_pos) {
-		intcon.GIE = 1;
-		return;
-	}
-	else {
-		rx_out_pos = (rx_out_pos + 1) & 0x3f;
-		rx_byte = rx_msg[rx_out_pos];
-	}
-	// turn on interrupts
-	intcon.GIE = 1;
-	// status byte
+// handle a new byte received from the stream - called from the ISR
+void midi_rx_byte(unsigned char rx_byte, unsigned int time) {
+	unsigned char stat;
+	// status byte - classify with a single table lookup
 	if(rx_byte & 0x80) {
-		stat = (rx_byte & 0xf0);
-	   	chan = (rx_byte & 0x0f);
-
-		// system messages
-   		if(stat == 0xf0) {
-			// realtime messages
-	     	if(rx_byte == MIDI_TIMING_TICK) {
-				_midi_rx_timing_tick();
-				return;
-    	 	}
-	     	if(rx_byte == MIDI_START_SONG) {
-				_midi_rx_start_song();
-				return;
-    		}	
-     		if(rx_byte == MIDI_CONTINUE_SONG) {
-				_midi_rx_continue_song();
-				return;
-     		}
-	     	if(rx_byte == MIDI_STOP_SONG) {
-				_midi_rx_stop_song();
-				return;
-	     	}
-			if(rx_byte == MIDI_ACTIVE_SENSING) {
-				_midi_rx_active_sensing();
-				return;
+		if(rx_byte >= 0xf0) stat = midi_stat_table[rx_byte - 0xe0];
+		else stat = midi_stat_table[rx_byte >> 4];
+		// unsupported status - ignore
+		if(stat == MIDI_KIND_NONE) return;
+		// realtime messages - do not disturb the current message
+		if((stat & MIDI_STAT_KIND) >= MIDI_KIND_TIMING_TICK) {
+			// echo clock and transport bytes ahead of queued output
+			if(rx_byte <= MIDI_STOP_SONG) {
+				if(!(tx_thru_class_block & MIDI_THRU_CLOCK)) midi_tx_rt_isr(rx_byte);
+			}
+			else if(tx_thru_mode == MIDI_THRU_CUT) {
+				// active sensing can go anywhere - system reset ends the message on the wire
+				if(rx_byte == MIDI_ACTIVE_SENSING) midi_tx_rt_isr(rx_byte);
+				else midi_tx_fwd_isr(rx_byte);
 			}
-			if(rx_byte == MIDI_SYSTEM_RESET) {
-				_midi_rx_system_reset();
-				return;
+			midi_rx_queue(stat & MIDI_STAT_KIND, 0, 0, time);
+			return;
+		}
+		// any other status byte ends an open sysex message
+		if(rx_state == RX_STATE_SYSEX_DATA && 
+				(stat & MIDI_STAT_KIND) != MIDI_KIND_SYSEX_END) {
+			midi_rx_queue(MIDI_KIND_SYSEX_END, 0, 0, time);
+		}
+		// the thru filter decides for the whole message at the status byte
+		if(tx_thru_mode == MIDI_THRU_CUT) {
+			tx_fwd_block = 0;
+			if(tx_thru_class_block & midi_kind_thru[stat & MIDI_STAT_KIND]) tx_fwd_block = 1;
+			else if((stat & MIDI_STAT_RUNNING) && 
+					(tx_thru_chan_block & ((unsigned int)1 << (rx_byte & 0x0f)))) {
+				tx_fwd_block = 1;
 			}
-			// system common messages
-    	 	if(rx_byte == MIDI_SONG_POSITION) {
-				rx_status_chan = 255;  // reset running status channel
-				rx_status = rx_byte;
-				rx_state = RX_STATE_DATA0;
-				return;
-    	 	}
-	     	if(rx_byte == MIDI_SONG_SELECT) {
-				rx_status_chan = 255;  // reset running status channel
-				rx_status = rx_byte;
-				rx_state = RX_STATE_DATA0;
-				return;
-    	 	}
-			// sysex messages
-    		if(rx_byte == MIDI_SYSEX_START) {
-				_midi_rx_sysex_start();
-				rx_status_chan = 255;  // reset running status channel
-				rx_status = rx_byte;
+			if(!tx_fwd_block) midi_tx_fwd_isr(rx_byte);
+		}
+		rx_status = stat;
+		rx_msg_time = time;
+		rx_msg_timed = 1;
+		// reset running status channel for system messages
+		if(stat & MIDI_STAT_RUNNING) rx_status_chan = (rx_byte & 0x0f);
+		else rx_status_chan = 255;
+		// sysex start / end - no data bytes
+		if((stat & MIDI_STAT_LEN) == MIDI_STAT_LEN0) {
+			midi_rx_queue(stat & MIDI_STAT_KIND, 0, 0, time);
+			rx_msg_timed = 0;
+			if((stat & MIDI_STAT_KIND) == MIDI_KIND_SYSEX_START) {
 				rx_state = RX_STATE_SYSEX_DATA;
-				return;
-	     	}
-	     	if(rx_byte == MIDI_SYSEX_END) {
-				_midi_rx_sysex_end();
-				rx_status_chan = 255;  // reset running status channel
+			}
+			else {
 				rx_status = 0;
 				rx_state = RX_STATE_IDLE;
-				return;
-     		}
-   		}
-	   	// channel messages
-   		else {
-     		if(stat == MIDI_NOTE_OFF) {
-				rx_status_chan = chan;
-				rx_status = stat;
-				rx_state = RX_STATE_DATA0;
-				return;
-	     	}
-    	 	if(stat == MIDI_NOTE_ON) {
-				rx_status_chan = chan;
-				rx_status = stat;
-				rx_state = RX_STATE_DATA0;
-				return;
-     		}
-	     	if(stat == MIDI_KEY_PRESSURE) {
-				rx_status_chan = chan;
-				rx_status = stat;
-				rx_state = RX_STATE_DATA0;
-				return;
-    	 	}
-	    	if(stat == MIDI_CONTROL_CHANGE) {
-				rx_status_chan = chan;
-				rx_status = stat;
-				rx_state = RX_STATE_DATA0;
-				return;
-	     	}
-    	 	if(stat == MIDI_PROG_CHANGE) {
-				rx_status_chan = chan;
-				rx_status = stat;
-				rx_state = RX_STATE_DATA0;
-				return;
-	     	}
-    	 	if(stat == MIDI_CHAN_PRESSURE) {
-				rx_status_chan = chan;
-				rx_status = stat;
-				rx_state = RX_STATE_DATA0;
-				return;
-	     	}
-    	 	if(stat == MIDI_PITCH_BEND) {
-				rx_status_chan = chan;
-				rx_status = stat;
-				rx_state = RX_STATE_DATA0;
-				return;
-	    	}
-   		}
-   		return;  // just in case
+			}
+			return;
+		}
+		rx_state = RX_STATE_DATA0;
+		return;
+	}
+	// forward data bytes that belong to a message
+	if(tx_thru_mode == MIDI_THRU_CUT && rx_state != RX_STATE_IDLE && !tx_fwd_block) {
+		midi_tx_fwd_isr(rx_byte);
 	}
  	// data byte 0
  	if(rx_state == RX_STATE_DATA0) {
    		rx_data0 = rx_byte;
-
-		// data length = 1 - process these messages right away
-   		if(rx_status == MIDI_SONG_SELECT ||
-				rx_status == MIDI_PROG_CHANGE ||
-      			rx_status == MIDI_CHAN_PRESSURE) {
-     		process_msg();
+		// running status - the message starts with this byte
+		if(!rx_msg_timed) {
+			rx_msg_time = time;
+			rx_msg_timed = 1;
+		}
+		// data length = 1 - queue these messages right away
+		if((rx_status & MIDI_STAT_LEN) == MIDI_STAT_LEN1) {
+			midi_rx_queue(rx_status & MIDI_STAT_KIND, rx_data0, 0, rx_msg_time);
+			rx_msg_timed = 0;
 			// if this message supports running status
-     		if(rx_status_chan != 255) {
+			if(rx_status & MIDI_STAT_RUNNING) {
 				rx_state = RX_STATE_DATA0;  // loop back for running status
 			}
 			else {
@@ -240,10 +360,14 @@ void midi_rx_task(void) {
 
  	// data byte 1
  	if(rx_state == RX_STATE_DATA1) {
-   		rx_data1 = rx_byte;
-   		process_msg();
+		// realtime bytes are acted on in the ISR - so is the position they follow
+		if((rx_status & MIDI_STAT_KIND) == MIDI_KIND_SONG_POSITION) {
+			_midi_isr_song_position(((unsigned int)rx_byte << 7) | rx_data0);
+		}
+		midi_rx_queue(rx_status & MIDI_STAT_KIND, rx_data0, rx_byte, rx_msg_time);
+		rx_msg_timed = 0;
 		// if this message supports running status
-   		if(rx_status_chan != 255) {   		
+		if(rx_status & MIDI_STAT_RUNNING) {
    			rx_state = RX_STATE_DATA0;  // loop back for running status
 		}
 		else {
@@ -254,57 +378,356 @@ void midi_rx_task(void) {
 
 	// sysex data
 	if(rx_state == RX_STATE_SYSEX_DATA) {
-		_midi_rx_sysex_data(rx_byte);
+		midi_rx_queue(MIDI_KIND_SYSEX_DATA, rx_byte, RX_SYSEX_EMPTY, time);
+		return;
+	}
+}
+
+// queue a complete message - called from the ISR
+void midi_rx_queue(unsigned char kind, unsigned char data0, 
+		unsigned char data1, unsigned int time) {
+	unsigned char lane, base, in_pos, next, depth, tail;
+	// notes, damper, channel mode and realtime messages jump ahead of everything else
+	// - a system reset waits behind the low lane so it releases the notes in there
+	//   unless the low lane is full - then it goes ahead rather than being lost
+	if(kind == MIDI_KIND_SYSTEM_RESET) {
+		in_pos = rx_in_pos[MIDI_RX_LANE_LOW];
+		if(in_pos != rx_out_pos[MIDI_RX_LANE_LOW] && 
+				((in_pos + 1) & MIDI_RX_LANE_MASK) != rx_out_pos[MIDI_RX_LANE_LOW]) {
+			lane = MIDI_RX_LANE_LOW;
+			rx_reset_in ++;
+		}
+		else lane = MIDI_RX_LANE_HIGH;
+	}
+	else if(kind >= MIDI_KIND_TIMING_TICK) {
+		lane = MIDI_RX_LANE_HIGH;
+	}
+	else if(kind == MIDI_KIND_NOTE_OFF || kind == MIDI_KIND_NOTE_ON ||
+			(kind == MIDI_KIND_CONTROL_CHANGE && (data0 == 64 || data0 >= 120))) {
+		// but never ahead of an older bend, program or CC on the same channel
+		// or of a system reset waiting in the low lane
+		if(rx_low_in[rx_status_chan] != rx_low_out[rx_status_chan] ||
+				rx_reset_in != rx_reset_out) lane = MIDI_RX_LANE_LOW;
+		else lane = MIDI_RX_LANE_HIGH;
+	}
+	else {
+		lane = MIDI_RX_LANE_LOW;
+	}
+	base = lane * MIDI_RX_LANE_SIZE;
+	in_pos = rx_in_pos[lane];
+	next = (in_pos + 1) & MIDI_RX_LANE_MASK;
+	depth = (in_pos - rx_out_pos[lane]) & MIDI_RX_LANE_MASK;
+	// backlog - replace a waiting bend / continuous CC with the newest value
+	// the tail is never the slot being handled when 2 or more are queued
+	if(depth > 1 && (kind == MIDI_KIND_PITCH_BEND || 
+			(kind == MIDI_KIND_CONTROL_CHANGE && midi_rx_cc_merge(data0)))) {
+		tail = base + ((in_pos - 1) & MIDI_RX_LANE_MASK);
+		if(rx_q_kind[tail] == kind && rx_q_chan[tail] == rx_status_chan &&
+				(kind == MIDI_KIND_PITCH_BEND || rx_q_data0[tail] == data0)) {
+			rx_q_data0[tail] = data0;
+			rx_q_data1[tail] = data1;
+			rx_q_time[tail] = time;
+			return;
+		}
+	}
+	// backlog - pack sysex data two bytes to a record
+	if(depth > 1 && kind == MIDI_KIND_SYSEX_DATA) {
+		tail = base + ((in_pos - 1) & MIDI_RX_LANE_MASK);
+		if(rx_q_kind[tail] == kind && rx_q_data1[tail] == RX_SYSEX_EMPTY) {
+			rx_q_data1[tail] = data0;
+			return;
+		}
+	}
+	// lane is full - drop the new message
+	if(next == rx_out_pos[lane]) {
+		midi_rx_error(MIDI_RX_STAT_OVERFLOW);
+		// the end of a sysex message may be gone - stop waiting for it
+		if(kind >= MIDI_KIND_SYSEX_START && kind <= MIDI_KIND_SYSEX_END) {
+			rx_sysex_lost = 1;
+		}
+		return;
+	}
+	// store the message before publishing the new position
+	rx_q_kind[base + in_pos] = kind;
+	rx_q_chan[base + in_pos] = rx_status_chan;
+	rx_q_data0[base + in_pos] = data0;
+	rx_q_data1[base + in_pos] = data1;
+	rx_q_time[base + in_pos] = time;
+	rx_in_pos[lane] = next;
+	if(lane == MIDI_RX_LANE_LOW && kind <= MIDI_KIND_PITCH_BEND) {
+		rx_low_in[rx_status_chan] ++;
+	}
+	// track the high water mark
+	depth ++;
+	if(depth > rx_stats[MIDI_RX_STAT_HIGH_WATER]) {
+		rx_stats[MIDI_RX_STAT_HIGH_WATER] = depth;
+	}
+}
+
+// check if a controller can be merged with a newer value - called from the ISR
+// switches (64-69) and channel mode messages (120-127) are never merged
+unsigned char midi_rx_cc_merge(unsigned char controller) {
+	if(controller < 64) return 1;
+	if(controller > 69 && controller < 120) return 1;
+	return 0;
+}
+
+// count a receive error - called from the ISR
+void midi_rx_error(unsigned char stat) {
+	if(rx_stats[stat] < MIDI_RX_STAT_MAX) rx_stats[stat] ++;
+}
+
+// load the next byte into the UART - called from the ISR when TXREG is empty
+void midi_tx_isr(void) {
+	unsigned char lane, data;
+	// realtime bytes can go between any two bytes of a message
+	if(tx_rt_in_pos != tx_rt_out_pos) {
+		txreg = tx_rt_msg[tx_rt_out_pos];
+		tx_rt_out_pos = (tx_rt_out_pos + 1) & MIDI_TX_RT_MASK;
+		tx_byte_count ++;
 		return;
 	}
+	// pick a lane - a message part way out keeps the wire, otherwise take turns
+	lane = tx_owner;
+	if(lane == TX_OWNER_NONE) {
+		if(tx_in_pos != tx_out_pos && (tx_last_owner == TX_OWNER_FWD ||
+				tx_fwd_in_pos == tx_fwd_out_pos)) {
+			lane = TX_OWNER_LOCAL;
+		}
+		else lane = TX_OWNER_FWD;
+	}
+	// forwarded bytes
+	if(lane == TX_OWNER_FWD) {
+		// nothing left to send - stop the interrupt until more is queued
+		if(tx_fwd_in_pos == tx_fwd_out_pos) {
+			pie1.TXIE = 0;
+			return;
+		}
+		data = tx_fwd_msg[tx_fwd_out_pos];
+		// a local message changed the running status - send ours again first
+		if(!(data & 0x80) && tx_owner == TX_OWNER_NONE &&
+				tx_fwd_status && tx_fwd_status != tx_wire_status) {
+			data = tx_fwd_status;
+		}
+		else tx_fwd_out_pos = (tx_fwd_out_pos + 1) & MIDI_TX_FWD_MASK;
+	}
+	// local bytes
+	else {
+		if(tx_in_pos == tx_out_pos) {
+			pie1.TXIE = 0;
+			return;
+		}
+		data = tx_msg[tx_out_pos];
+		tx_out_pos ++;
+	}
+	midi_tx_track(data, lane);
+	txreg = data;
+	tx_byte_count ++;
+}
+
+// follow message boundaries on the wire - called from the ISR
+void midi_tx_track(unsigned char data, unsigned char lane) {
+	unsigned char stat;
+	if(data & 0x80) {
+		// realtime bytes other than system reset do not affect the message
+		if(data >= MIDI_TIMING_TICK && data != MIDI_SYSTEM_RESET) return;
+		if(data >= 0xf0) stat = midi_stat_table[data - 0xe0];
+		else stat = midi_stat_table[data >> 4];
+		// channel messages set running status - system messages clear it
+		if(stat & MIDI_STAT_RUNNING) tx_wire_status = data;
+		else tx_wire_status = 0;
+		if(lane == TX_OWNER_FWD) tx_fwd_status = tx_wire_status;
+		tx_len = (stat & MIDI_STAT_LEN) >> 5;
+		if(data == MIDI_SYSEX_START) tx_left = TX_LEFT_SYSEX;
+		else tx_left = tx_len;
+	}
+	else {
+		// running status - this byte starts a new message
+		if(tx_left == 0) tx_left = tx_len;
+		if(tx_left != 0 && tx_left != TX_LEFT_SYSEX) tx_left --;
+	}
+	if(tx_left == 0) {
+		tx_owner = TX_OWNER_NONE;
+		tx_last_owner = lane;
+	}
+	else tx_owner = lane;
+}
+
+// run the MIDI timer task - every 4ms
+void midi_timer_task(void) {
+	// give up on a forwarded message that stopped part way so local output can go
+	intcon.GIE = 0;  // the forward state is changed by the ISR
+	if(tx_owner == TX_OWNER_FWD && tx_fwd_in_pos == tx_fwd_out_pos) {
+		tx_fwd_idle ++;
+		if(tx_fwd_idle > MIDI_TX_FWD_TIMEOUT) {
+			tx_owner = TX_OWNER_NONE;
+			tx_wire_status = 0;
+			tx_fwd_status = 0;
+			pie1.TXIE = 1;
+		}
+	}
+	intcon.GIE = 1;
+
+	tx_rate_ticks ++;
+	if(tx_rate_ticks < MIDI_TX_RATE_TICKS) return;
+	tx_rate_ticks = 0;
+	// latch the bytes sent in the last second
+	intcon.GIE = 0;  // the count is changed by the ISR
+	tx_rate = tx_byte_count;
+	tx_byte_count = 0;
+	intcon.GIE = 1;
+}
+
+// receive task - handle queued messages up to the budget
+void midi_rx_task(void) {
+	unsigned char count, lane, slot;
+	unsigned int time;
+	// nothing queued - keep the depths from the last drain
+	if(rx_in_pos[MIDI_RX_LANE_HIGH] == rx_out_pos[MIDI_RX_LANE_HIGH] &&
+			rx_in_pos[MIDI_RX_LANE_LOW] == rx_out_pos[MIDI_RX_LANE_LOW]) {
+		return;
+	}
+	// queue depth before draining
+	rx_depth_pre = midi_rx_depth();
+	// a dropped sysex record may have been the end - let notes through again
+	if(rx_sysex_lost) {
+		rx_sysex_lost = 0;
+		rx_sysex_open = 0;
+	}
+	for(count = 0; count < rx_drain_max; count ++) {
+		// yield if the task timer is due
+		if(pir1.TMR1IF) break;
+		// get a message from the highest priority lane that has one
+		// the ISR only ever moves rx_in_pos
+		// - an open sysex is streamed to the output so it must finish first
+		if(rx_sysex_open && rx_in_pos[MIDI_RX_LANE_LOW] != rx_out_pos[MIDI_RX_LANE_LOW]) {
+			lane = MIDI_RX_LANE_LOW;
+		}
+		else if(rx_in_pos[MIDI_RX_LANE_HIGH] != rx_out_pos[MIDI_RX_LANE_HIGH]) {
+			lane = MIDI_RX_LANE_HIGH;
+		}
+		else if(rx_in_pos[MIDI_RX_LANE_LOW] != rx_out_pos[MIDI_RX_LANE_LOW]) {
+			lane = MIDI_RX_LANE_LOW;
+		}
+		else {
+			break;
+		}
+		slot = lane * MIDI_RX_LANE_SIZE + rx_out_pos[lane];
+		process_msg(slot);
+		// track how long a note takes to get through us - it has been echoed by now
+		if(rx_q_kind[slot] == MIDI_KIND_NOTE_ON) {
+			time = midi_get_time() - rx_q_time[slot];
+			rx_hop_lat = rx_hop_lat - (rx_hop_lat >> 3) + (time >> 3);
+		}
+		// release the slot once we are done with it
+		if(lane == MIDI_RX_LANE_LOW) {
+			if(rx_q_kind[slot] <= MIDI_KIND_PITCH_BEND) rx_low_out[rx_q_chan[slot]] ++;
+			else if(rx_q_kind[slot] == MIDI_KIND_SYSTEM_RESET) rx_reset_out ++;
+		}
+		rx_out_pos[lane] = (rx_out_pos[lane] + 1) & MIDI_RX_LANE_MASK;
+	}
+	// queue depth after draining
+	rx_depth_post = midi_rx_depth();
+}
+
+// get the number of queued messages in all lanes
+unsigned char midi_rx_depth(void) {
+	return ((rx_in_pos[MIDI_RX_LANE_HIGH] - rx_out_pos[MIDI_RX_LANE_HIGH]) & 
+		MIDI_RX_LANE_MASK) +
+		((rx_in_pos[MIDI_RX_LANE_LOW] - rx_out_pos[MIDI_RX_LANE_LOW]) & 
+		MIDI_RX_LANE_MASK);
 }
 
 // process a received message
-void process_msg(void) {
-	if(rx_status == MIDI_SONG_POSITION) {
-   		_midi_rx_song_position((rx_data1 >> 7) | rx_data0);
-   		return;
- 	}
- 	if(rx_status == MIDI_SONG_SELECT) {
-   		_midi_rx_song_select(rx_data0);
-   		return;
- 	}
-	// this is a channel message by this point
-	if(midi_learn_mode) {
-		_midi_learn_channel(rx_status_chan);
+void process_msg(unsigned char slot) {
+	unsigned char kind = rx_q_kind[slot];
+	unsigned char chan = rx_q_chan[slot];
+	unsigned char data0 = rx_q_data0[slot];
+	unsigned char data1 = rx_q_data1[slot];
+	rx_cb_time = rx_q_time[slot];
+	// any other status byte ends an open sysex message on the wire
+	if(kind != MIDI_KIND_SYSEX_DATA && kind < MIDI_KIND_TIMING_TICK) {
+		rx_sysex_open = 0;
+	}
+	// learn the channel from channel messages
+	if(midi_learn_mode && kind <= MIDI_KIND_PITCH_BEND) {
+		_midi_learn_channel(chan);
 		midi_set_learn_mode(0);  // turn this off
 	}
- 	if(rx_status == MIDI_NOTE_OFF) {
-   		_midi_rx_note_off(rx_status_chan, rx_data0);
-   		return;
- 	}
- 	if(rx_status == MIDI_NOTE_ON) {
-   		if(rx_data1 == 0) _midi_rx_note_off(rx_status_chan, rx_data0);
-   		else _midi_rx_note_on(rx_status_chan, rx_data0, rx_data1);
-   		return;
- 	}
- 	if(rx_status == MIDI_KEY_PRESSURE) {
-   		_midi_rx_key_pressure(rx_status_chan, rx_data0, rx_data1);
-   		return;
- 	}
- 	if(rx_status == MIDI_CONTROL_CHANGE) {
-   		_midi_rx_control_change(rx_status_chan, rx_data0, rx_data1);
-   		return;
- 	}
- 	if(rx_status == MIDI_PROG_CHANGE) {
-   		_midi_rx_program_change(rx_status_chan, rx_data0);
-   		return;
- 	}
- 	if(rx_status == MIDI_CHAN_PRESSURE) {
-   		_midi_rx_channel_pressure(rx_status_chan, rx_data0);
-   		return;
- 	}
- 	if(rx_status == MIDI_PITCH_BEND) {
-   		_midi_rx_pitch_bend(rx_status_chan, 
-			(unsigned int) (((unsigned int) rx_data1 << 7) | 
-			(unsigned int) rx_data0));
-   		return;
- 	}
+	switch(kind) {
+		// channel messages
+		case MIDI_KIND_NOTE_OFF:
+			_midi_rx_note_off(chan, data0);
+			break;
+		case MIDI_KIND_NOTE_ON:
+			if(data1 == 0) _midi_rx_note_off(chan, data0);
+			else if(midi_setup_mode) _midi_setup_note_on(chan, data0, data1);
+			else _midi_rx_note_on(chan, data0, data1);
+			break;
+		case MIDI_KIND_KEY_PRESSURE:
+			_midi_rx_key_pressure(chan, data0, data1);
+			break;
+		case MIDI_KIND_CONTROL_CHANGE:
+			if(midi_setup_mode) _midi_setup_control_change(chan, data0, data1);
+			else _midi_rx_control_change(chan, data0, data1);
+			break;
+		case MIDI_KIND_PROG_CHANGE:
+			_midi_rx_program_change(chan, data0);
+			break;
+		case MIDI_KIND_CHAN_PRESSURE:
+			_midi_rx_channel_pressure(chan, data0);
+			break;
+		case MIDI_KIND_PITCH_BEND:
+			if(midi_setup_mode) {
+				_midi_setup_pitch_bend(chan, 
+					(unsigned int) (((unsigned int) data1 << 7) | 
+					(unsigned int) data0));
+			}
+			else {
+				_midi_rx_pitch_bend(chan, 
+					(unsigned int) (((unsigned int) data1 << 7) | 
+					(unsigned int) data0));
+			}
+			break;
+		// system common messages
+		case MIDI_KIND_SONG_POSITION:
+			_midi_rx_song_position(((unsigned int)data1 << 7) | data0);
+			break;
+		case MIDI_KIND_SONG_SELECT:
+			_midi_rx_song_select(data0);
+			break;
+		// sysex messages
+		case MIDI_KIND_SYSEX_START:
+			rx_sysex_open = 1;
+			_midi_rx_sysex_start();
+			break;
+		case MIDI_KIND_SYSEX_DATA:
+			_midi_rx_sysex_data(data0);
+			if(data1 != RX_SYSEX_EMPTY) _midi_rx_sysex_data(data1);
+			break;
+		case MIDI_KIND_SYSEX_END:
+			_midi_rx_sysex_end();
+			break;
+		// system realtime messages
+		case MIDI_KIND_TIMING_TICK:
+			_midi_rx_timing_tick();
+			break;
+		case MIDI_KIND_START_SONG:
+			_midi_rx_start_song();
+			break;
+		case MIDI_KIND_CONTINUE_SONG:
+			_midi_rx_continue_song();
+			break;
+		case MIDI_KIND_STOP_SONG:
+			_midi_rx_stop_song();
+			break;
+		case MIDI_KIND_ACTIVE_SENSING:
+			_midi_rx_active_sensing();
+			break;
+		case MIDI_KIND_SYSTEM_RESET:
+			_midi_rx_system_reset();
+			break;
+	}
 }
 
 // sets the learn mode - 1 = on, 0 = off
@@ -312,115 +735,350 @@ void midi_set_learn_mode(unsigned char mode) {
 	midi_learn_mode = (mode & 0x01);
 }
 
+// sets the setup mode - 1 = setup callbacks, 0 = play callbacks
+void midi_set_setup_mode(unsigned char mode) {
+	midi_setup_mode = (mode & 0x01);
+}
+
+// sets the max number of messages handled per RX task call
+void midi_set_rx_drain(unsigned char max) {
+	rx_drain_max = max;
+	if(rx_drain_max == 0) rx_drain_max = 1;
+}
+
+// sets how many status bytes running status can leave out before the
+// status is sent again - 0 = running status off
+void midi_set_tx_running_status(unsigned char max) {
+	tx_running_max = max;
+	tx_running_status = 0;  // start with a full status byte
+}
+
+// set the thru mode - MIDI_THRU_ECHO or MIDI_THRU_CUT
+void midi_set_thru_mode(unsigned char mode) {
+	tx_thru_mode = mode;  // single byte so the ISR always sees a whole value
+	tx_running_status = 0;  // start with a full status byte
+}
+
+// gets the thru mode
+unsigned char midi_get_thru_mode(void) {
+	return tx_thru_mode;
+}
+
+// set the thru filter - set bits block channels (bit 0 = channel 1) and MIDI_THRU_* classes
+void midi_set_thru_filter(unsigned int chan_block, unsigned char class_block) {
+	intcon.GIE = 0;  // the filter is used by the ISR
+	tx_thru_chan_block = chan_block;
+	tx_thru_class_block = class_block;
+	intcon.GIE = 1;
+}
+
+// check if a parsed message should be echoed - channel is MIDI_THRU_NO_CHAN for system messages
+unsigned char midi_thru_echo(unsigned char class, unsigned char channel) {
+	if(tx_thru_mode != MIDI_THRU_ECHO) return 0;  // the ISR forwards it
+	if(tx_thru_class_block & class) return 0;
+	if(channel < 16 && (tx_thru_chan_block & ((unsigned int)1 << channel))) return 0;
+	return 1;
+}
+
+// set the TX queue bytes kept free for normal messages
+void midi_set_tx_headroom(unsigned char bytes) {
+	tx_headroom = bytes;
+}
+
+// gets the bytes sent in the last second - MIDI_TX_LINE_RATE when saturated
+unsigned int midi_get_tx_rate(void) {
+	return tx_rate;
+}
+
+// gets the RX queue depth before the last drain
+unsigned char midi_get_rx_depth_pre(void) {
+	return rx_depth_pre;
+}
+
+// gets the RX queue depth after the last drain
+unsigned char midi_get_rx_depth_post(void) {
+	return rx_depth_post;
+}
+
+// gets the receive timestamp of the message being handled - 1us per count
+unsigned int midi_get_rx_time(void) {
+	return rx_cb_time;
+}
+
+// gets the current timestamp timer value - 1us per count
+unsigned int midi_get_time(void) {
+	unsigned int time;
+	intcon.GIE = 0;  // the ISR also uses the TMR3H latch
+	time = tmr3l;  // reading TMR3L latches TMR3H
+	time |= ((unsigned int)tmr3h << 8);
+	intcon.GIE = 1;
+	return time;
+}
+
+// gets the time from a note arriving to it arriving at the next unit - us
+unsigned int midi_get_hop_latency(void) {
+	unsigned int lat = MIDI_TX_BYTE_US;
+	// cut-through forwards each byte as it arrives
+	if(tx_thru_mode == MIDI_THRU_ECHO) lat += rx_hop_lat;
+	if(lat > 0x3fff) lat = 0x3fff;
+	return lat;
+}
+
+// gets a receive health counter
+unsigned int midi_get_rx_stat(unsigned char stat) {
+	unsigned int val;
+	if(stat >= MIDI_RX_STATS) return 0;
+	intcon.GIE = 0;  // counters are changed by the ISR
+	val = rx_stats[stat];
+	intcon.GIE = 1;
+	return val;
+}
+
+// clears the receive health counters
+void midi_clear_rx_stats(void) {
+	unsigned char i;
+	intcon.GIE = 0;  // counters are changed by the ISR
+	for(i = 0; i < MIDI_RX_STATS; i ++) {
+		rx_stats[i] = 0;
+	}
+	intcon.GIE = 1;
+}
+
+// gets a transmit drop counter
+unsigned int midi_get_tx_stat(unsigned char stat) {
+	unsigned int val;
+	if(stat >= MIDI_TX_STATS) return 0;
+	intcon.GIE = 0;  // the forward counter is changed by the ISR
+	val = tx_stats[stat];
+	intcon.GIE = 1;
+	return val;
+}
+
+// clear the transmit drop counters
+void midi_clear_tx_stats(void) {
+	unsigned char i;
+	intcon.GIE = 0;  // the forward counter is changed by the ISR
+	for(i = 0; i < MIDI_TX_STATS; i ++) {
+		tx_stats[i] = 0;
+	}
+	intcon.GIE = 1;
+}
+
 //
 // SENDERS
 //
+// reserve queue space for a whole message - returns 0 if it must be dropped
+// - the status byte is always counted even if running status leaves it out
+unsigned char midi_tx_reserve(unsigned char len, unsigned char class) {
+	unsigned char free;
+	free = tx_out_pos - tx_in_pos - 1;  // tx_out_pos is a single byte so no masking needed
+	// controller data leaves headroom so notes and sysex still fit
+	if(class == MIDI_TX_CLASS_CONTROL) {
+		if(free < tx_headroom || (free - tx_headroom) < len) {
+			if(tx_stats[MIDI_TX_STAT_CONTROL_DROP] < MIDI_RX_STAT_MAX) {
+				tx_stats[MIDI_TX_STAT_CONTROL_DROP] ++;
+			}
+			tx_reserve_left = 0;
+			return 0;
+		}
+	}
+	else if(free < len) {
+		if(tx_stats[MIDI_TX_STAT_DROP] < MIDI_RX_STAT_MAX) tx_stats[MIDI_TX_STAT_DROP] ++;
+		tx_reserve_left = 0;
+		return 0;
+	}
+	tx_reserve_left = len;
+	return 1;
+}
+
+// queue a byte for sending and make sure the transmitter is running
+// - bytes outside a reservation are dropped so a message is never split
+void midi_tx_byte(unsigned char data) {
+	if(tx_reserve_left == 0) return;
+	tx_reserve_left --;
+	tx_msg[tx_in_pos] = data;  // store the byte before publishing it
+	tx_in_pos ++;
+	pie1.TXIE = 1;
+}
+
+// send a channel status byte unless running status already covers it
+// - cut-through mode always sends it so forwarded messages can go in between
+void midi_tx_status(unsigned char stat) {
+	if(stat == tx_running_status && tx_running_count < tx_running_max &&
+			tx_thru_mode == MIDI_THRU_ECHO) {
+		tx_running_count ++;
+		return;
+	}
+	midi_tx_byte(stat);
+	tx_running_status = stat;
+	tx_running_count = 0;
+}
+
 // send note off - sends note on with velocity 0
 void _midi_tx_note_off(unsigned char channel,
 		unsigned char note) {  
- 	tx_msg[TX_IN_POS] = MIDI_NOTE_ON | (channel & 0x0f);
- 	tx_msg[TX_IN_POS] = (note & 0x7f);
- 	tx_msg[TX_IN_POS] = 0x00;
+	if(!midi_tx_reserve(3, MIDI_TX_CLASS_NORMAL)) return;
+	midi_tx_status(MIDI_NOTE_ON | (channel & 0x0f));
+ 	midi_tx_byte(note & 0x7f);
+ 	midi_tx_byte(0x00);
 }
 
 // send note on
 void _midi_tx_note_on(unsigned char channel,
 		unsigned char note,
 		unsigned char velocity) {
-	tx_msg[TX_IN_POS] = MIDI_NOTE_ON | (channel & 0x0f);
- 	tx_msg[TX_IN_POS] = (note & 0x7f);
- 	tx_msg[TX_IN_POS] = (velocity & 0x7f);	
+	if(!midi_tx_reserve(3, MIDI_TX_CLASS_NORMAL)) return;
+	midi_tx_status(MIDI_NOTE_ON | (channel & 0x0f));
+ 	midi_tx_byte(note & 0x7f);
+ 	midi_tx_byte(velocity & 0x7f);	
 }
 
 // key pressure
 void _midi_tx_key_pressure(unsigned char channel,
 			   unsigned char note,
 			   unsigned char pressure) {
-	tx_msg[TX_IN_POS] = MIDI_KEY_PRESSURE | (channel & 0x0f);
- 	tx_msg[TX_IN_POS] = (note & 0x7f);
- 	tx_msg[TX_IN_POS] = (pressure & 0x7f);
+	if(!midi_tx_reserve(3, MIDI_TX_CLASS_CONTROL)) return;
+	midi_tx_status(MIDI_KEY_PRESSURE | (channel & 0x0f));
+ 	midi_tx_byte(note & 0x7f);
+ 	midi_tx_byte(pressure & 0x7f);
 }
 
 // control change
 void _midi_tx_control_change(unsigned char channel,
 		unsigned char controller,
 		unsigned char value) {
- 	tx_msg[TX_IN_POS] = MIDI_CONTROL_CHANGE | (channel & 0x0f);
- 	tx_msg[TX_IN_POS] = (controller & 0x7f);
- 	tx_msg[TX_IN_POS] = (value & 0x7f);
+	if(!midi_tx_reserve(3, MIDI_TX_CLASS_CONTROL)) return;
+	midi_tx_status(MIDI_CONTROL_CHANGE | (channel & 0x0f));
+ 	midi_tx_byte(controller & 0x7f);
+ 	midi_tx_byte(value & 0x7f);
 }
 
 // program change
 void _midi_tx_program_change(unsigned char channel,
 		unsigned char program) {
- 	tx_msg[TX_IN_POS] = MIDI_PROG_CHANGE | (channel & 0x0f);
- 	tx_msg[TX_IN_POS] = (program & 0x7f);
+	if(!midi_tx_reserve(2, MIDI_TX_CLASS_CONTROL)) return;
+	midi_tx_status(MIDI_PROG_CHANGE | (channel & 0x0f));
+ 	midi_tx_byte(program & 0x7f);
 }
 
 // channel pressure
 void _midi_tx_channel_pressure(unsigned char channel,
 			       unsigned char pressure) {
- 	tx_msg[TX_IN_POS] = MIDI_CHAN_PRESSURE | (channel & 0x0f);
- 	tx_msg[TX_IN_POS] = (pressure & 0x7f);
+	if(!midi_tx_reserve(2, MIDI_TX_CLASS_CONTROL)) return;
+	midi_tx_status(MIDI_CHAN_PRESSURE | (channel & 0x0f));
+ 	midi_tx_byte(pressure & 0x7f);
 }
 
 // pitch bend
 void _midi_tx_pitch_bend(unsigned char channel,
 		unsigned int bend) {
- 	tx_msg[TX_IN_POS] = MIDI_PITCH_BEND | (channel & 0x0f);
- 	tx_msg[TX_IN_POS] = (bend & 0x7f);
- 	tx_msg[TX_IN_POS] = (bend & 0x3f80) >> 7;
+	if(!midi_tx_reserve(3, MIDI_TX_CLASS_CONTROL)) return;
+	midi_tx_status(MIDI_PITCH_BEND | (channel & 0x0f));
+ 	midi_tx_byte(bend & 0x7f);
+ 	midi_tx_byte((bend & 0x3f80) >> 7);
 }
 
 // sysex message start
+// - the caller reserves the whole message with midi_tx_reserve() first
 void _midi_tx_sysex_start(void) {
-	tx_msg[TX_IN_POS] = MIDI_SYSEX_START;
+	tx_running_status = 0;  // system common cancels running status
+	midi_tx_byte(MIDI_SYSEX_START);
 }
 
 // sysex message data byte
 void _midi_tx_sysex_data(unsigned char data_byte) {
- 	tx_msg[TX_IN_POS] = data_byte;
+ 	midi_tx_byte(data_byte);
 }
 
 // sysex message end
 void _midi_tx_sysex_end(void) {
-	tx_msg[TX_IN_POS] = MIDI_SYSEX_END;
+	tx_running_status = 0;
+	midi_tx_byte(MIDI_SYSEX_END);
 }
 
 // song position
 void _midi_tx_song_position(unsigned int pos) {
-	tx_msg[TX_IN_POS] = MIDI_SONG_POSITION;
- 	tx_msg[TX_IN_POS] = (pos & 0x7f);
- 	tx_msg[TX_IN_POS] = (pos & 0x3f8) >> 7;
+	if(!midi_tx_reserve(3, MIDI_TX_CLASS_NORMAL)) return;
+	tx_running_status = 0;
+	midi_tx_byte(MIDI_SONG_POSITION);
+ 	midi_tx_byte(pos & 0x7f);
+ 	midi_tx_byte((pos & 0x3f8) >> 7);
 }
 
 // song select
 void _midi_tx_song_select(unsigned char song) {
-	tx_msg[TX_IN_POS] = MIDI_SONG_SELECT;
-	tx_msg[TX_IN_POS] = (song & 0x7f);
+	if(!midi_tx_reserve(2, MIDI_TX_CLASS_NORMAL)) return;
+	tx_running_status = 0;
+	midi_tx_byte(MIDI_SONG_SELECT);
+	midi_tx_byte(song & 0x7f);
+}
+
+// forward a received byte in cut-through mode - called from the ISR
+void midi_tx_fwd_isr(unsigned char data) {
+	unsigned char next;
+	tx_fwd_idle = 0;
+	// a new status byte ends any message we were dropping
+	if(data & 0x80) tx_fwd_skip = 0;
+	else if(tx_fwd_skip) return;
+	next = (tx_fwd_in_pos + 1) & MIDI_TX_FWD_MASK;
+	// full - drop the rest of the message
+	if(next == tx_fwd_out_pos) {
+		tx_fwd_skip = 1;
+		if(tx_stats[MIDI_TX_STAT_FWD_DROP] < MIDI_RX_STAT_MAX) {
+			tx_stats[MIDI_TX_STAT_FWD_DROP] ++;
+		}
+		return;
+	}
+	tx_fwd_msg[tx_fwd_in_pos] = data;
+	tx_fwd_in_pos = next;
+	pie1.TXIE = 1;
+}
+
+// queue a realtime byte ahead of other output - called from the ISR
+void midi_tx_rt_isr(unsigned char data) {
+	unsigned char next = (tx_rt_in_pos + 1) & MIDI_TX_RT_MASK;
+	if(next == tx_rt_out_pos) return;  // full
+	tx_rt_msg[tx_rt_in_pos] = data;
+	tx_rt_in_pos = next;
+	pie1.TXIE = 1;
+}
+
+// queue a realtime byte ahead of other output
+void midi_tx_rt_byte(unsigned char data) {
+	unsigned char next;
+	intcon.GIE = 0;  // the realtime lane is also written by the ISR
+	next = (tx_rt_in_pos + 1) & MIDI_TX_RT_MASK;
+	if(next != tx_rt_out_pos) {
+		tx_rt_msg[tx_rt_in_pos] = data;
+		tx_rt_in_pos = next;
+		pie1.TXIE = 1;
+	}
+	intcon.GIE = 1;
 }
 
 // timing tick
 void _midi_tx_timing_tick(void) {
-	tx_msg[TX_IN_POS] = MIDI_TIMING_TICK;
+	midi_tx_rt_byte(MIDI_TIMING_TICK);
 }
 
 // start song
 void _midi_tx_start_song(void) {
- 	tx_msg[TX_IN_POS] = MIDI_START_SONG;
+ 	midi_tx_rt_byte(MIDI_START_SONG);
 }
 
 // continue song
 void _midi_tx_continue_song(void) {
- 	tx_msg[TX_IN_POS] = MIDI_CONTINUE_SONG;
+ 	midi_tx_rt_byte(MIDI_CONTINUE_SONG);
 }
 
 // stop song
 void _midi_tx_stop_song(void) {
- 	tx_msg[TX_IN_POS] = MIDI_STOP_SONG;
+ 	midi_tx_rt_byte(MIDI_STOP_SONG);
 }
 
 // system reset
 void _midi_tx_system_reset(void) {
- 	tx_msg[TX_IN_POS] = MIDI_SYSTEM_RESET;
+	if(!midi_tx_reserve(1, MIDI_TX_CLASS_NORMAL)) return;
+	tx_running_status = 0;
+ 	midi_tx_byte(MIDI_SYSTEM_RESET);
 }
@@ -5,11 +5,101 @@
  * Written by: Andrew Kilpatrick
  *
  */
+// system realtime messages
+#define MIDI_TIMING_TICK 0xf8
+#define MIDI_START_SONG 0xfa
+#define MIDI_CONTINUE_SONG 0xfb
+#define MIDI_STOP_SONG 0xfc
+#define MIDI_ACTIVE_SENSING 0xfe
+#define MIDI_SYSTEM_RESET 0xff
+
+// RX message queue size per priority lane - must be a power of 2
+#define MIDI_RX_LANE_SIZE 16
+#define MIDI_RX_LANE_MASK (MIDI_RX_LANE_SIZE - 1)
+
+// receive health counters - saturate at 14 bits so they fit in 2 sysex bytes
+#define MIDI_RX_STATS 4
+#define MIDI_RX_STAT_OVERRUN 0  // UART overrun errors
+#define MIDI_RX_STAT_FRAMING 1  // UART framing errors
+#define MIDI_RX_STAT_OVERFLOW 2  // messages dropped because the RX queue was full
+#define MIDI_RX_STAT_HIGH_WATER 3  // max RX queue lane depth seen
+#define MIDI_RX_STAT_MAX 0x3fff
+
+// max messages handled per RX task call - stops early if the task timer is due
+#define MIDI_RX_DRAIN_MAX 8
+
+// TX rate measurement - 260 * 3.84ms timer task calls is about 1 second
+#define MIDI_TX_RATE_TICKS 260
+#define MIDI_TX_LINE_RATE 3125  // bytes per second at 31250bps
+#define MIDI_TX_BYTE_US 320  // time to send one byte at 31250bps
+
+// TX realtime lane size - must be a power of 2
+#define MIDI_TX_RT_SIZE 8
+#define MIDI_TX_RT_MASK (MIDI_TX_RT_SIZE - 1)
+
+// TX running status - status bytes left out before the status is sent again
+#define MIDI_TX_RUNNING_STATUS_MAX 16
+
+// TX queue message classes - controller data is dropped first when the queue fills
+#define MIDI_TX_CLASS_CONTROL 0  // CC, pressure, pitch bend, program change
+#define MIDI_TX_CLASS_NORMAL 1  // notes, sysex and system messages
+
+// TX queue bytes kept free for normal messages - controller data is dropped first
+#define MIDI_TX_CONTROL_HEADROOM 32
+
+// transmit drop counters - saturate at MIDI_RX_STAT_MAX
+#define MIDI_TX_STATS 3
+#define MIDI_TX_STAT_CONTROL_DROP 0  // controller messages dropped
+#define MIDI_TX_STAT_DROP 1  // normal messages dropped because the TX queue was full
+#define MIDI_TX_STAT_FWD_DROP 2  // forwarded messages cut short because the forward lane was full
+
+// thru modes
+#define MIDI_THRU_ECHO 0  // mapped messages are echoed after they are parsed
+#define MIDI_THRU_CUT 1  // received bytes are forwarded by the ISR as they arrive
+
+// thru filter message classes - a set bit in the class mask blocks the class
+#define MIDI_THRU_NOTE 0x01  // note on / off
+#define MIDI_THRU_CC 0x02  // control change
+#define MIDI_THRU_BEND 0x04  // pitch bend
+#define MIDI_THRU_PRESSURE 0x08  // key and channel pressure
+#define MIDI_THRU_PROGRAM 0x10  // program change
+#define MIDI_THRU_CLOCK 0x20  // clock, transport, song position and song select
+#define MIDI_THRU_SYSEX 0x40  // system exclusive
+#define MIDI_THRU_NO_CHAN 0xff  // channel for system messages
+
+// TX forward lane size for cut-through thru - must be a power of 2
+#define MIDI_TX_FWD_SIZE 32
+#define MIDI_TX_FWD_MASK (MIDI_TX_FWD_SIZE - 1)
+
+// timer task calls a stalled forwarded message can hold the output
+#define MIDI_TX_FWD_TIMEOUT 3
+
 void midi_init(void);
-void midi_rx_byte(unsigned char rx_byte);
-void midi_tx_task(void);
+void midi_rx_byte(unsigned char rx_byte, unsigned int time);
+void midi_rx_error(unsigned char stat);
+void midi_tx_isr(void);
+void midi_timer_task(void);
 void midi_rx_task(void);
 void midi_set_learn_mode(unsigned char mode);
+void midi_set_setup_mode(unsigned char mode);
+void midi_set_rx_drain(unsigned char max);
+void midi_set_tx_running_status(unsigned char max);
+void midi_set_tx_headroom(unsigned char bytes);
+void midi_set_thru_mode(unsigned char mode);
+unsigned char midi_get_thru_mode(void);
+void midi_set_thru_filter(unsigned int chan_block, unsigned char class_block);
+unsigned char midi_thru_echo(unsigned char class, unsigned char channel);
+unsigned char midi_tx_reserve(unsigned char len, unsigned char class);
+unsigned int midi_get_tx_rate(void);
+unsigned char midi_get_rx_depth_pre(void);
+unsigned char midi_get_rx_depth_post(void);
+unsigned int midi_get_rx_time(void);
+unsigned int midi_get_time(void);
+unsigned int midi_get_hop_latency(void);
+unsigned int midi_get_rx_stat(unsigned char stat);
+void midi_clear_rx_stats(void);
+unsigned int midi_get_tx_stat(unsigned char stat);
+void midi_clear_tx_stats(void);
 
 // senders
 void _midi_tx_note_on(unsigned char channel,
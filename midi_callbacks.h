@@ -4,6 +4,8 @@
 * Copyright 2009: Kilpatrick Audio
 * Written by: Andrew Kilpatrick
 *
+* The receive timestamp of the message being handled can be read
+* from any of these callbacks with midi_get_rx_time().
 */
 //
 // SETUP MESSAGES
@@ -11,6 +13,20 @@
 // learn the MIDI channel
 void _midi_learn_channel(unsigned char channel);
 
+// note on setup - called instead of _midi_rx_note_on() in setup mode
+void _midi_setup_note_on(unsigned char channel, 
+	unsigned char note, 
+	unsigned char velocity);
+
+// control change setup - called instead of _midi_rx_control_change() in setup mode
+void _midi_setup_control_change(unsigned char channel,
+	unsigned char controller,
+	unsigned char value);
+
+// pitch bend setup - called instead of _midi_rx_pitch_bend() in setup mode
+void _midi_setup_pitch_bend(unsigned char channel,
+	unsigned int bend);
+
 //
 // CHANNEL MESSAGES
 //
@@ -51,6 +67,10 @@ void _midi_rx_pitch_bend(unsigned char channel,
 // song position
 void _midi_rx_song_position(unsigned int pos);
 
+// song position - called from the ISR as soon as the message is complete
+// so the clock is in place before any clock or continue byte after it
+void _midi_isr_song_position(unsigned int pos);
+
 // song select
 void _midi_rx_song_select(unsigned char song);
 
@@ -12,6 +12,7 @@
 #include <system.h>
 #include "setup.h"
 #include "ioctl.h"
+#include "midi.h"
 #include "config_store.h"
 
 // config
@@ -281,6 +282,8 @@ void setup_mode_next(void) {
 	}
 	// reset the mode blinking
 	setup_mode_blink = 0;
+	// send channel messages to the setup callbacks while in a setup mode
+	midi_set_setup_mode(setup_mode != SETUP_MODE_NONE);
 }
 
 // cancel setup mode
@@ -292,6 +295,7 @@ void setup_mode_cancel(void) {
 	setup_mode_old = setup_mode;
 	setup_mode = 0;
 	setup_mode_timeout = 0;
+	midi_set_setup_mode(0);
 }
 
 // reset the setup - for manual clear or new firmware load
@@ -12,72 +12,176 @@
 #include "voice.h"
 #include "event.h"
 
-#define SYSEX_TX_MAX_LEN 64
-unsigned char sysex_tx_buf[SYSEX_TX_MAX_LEN];
-unsigned char sysex_tx_len;
+// receive state
+#define SYSEX_STATE_IDLE 0
+#define SYSEX_STATE_HEADER 1  // matching the K1600 header
+#define SYSEX_STATE_CAPTURE 2  // K1600 message - buffered for parsing at the end
+#define SYSEX_STATE_STREAM 3  // other message - passed through only
+
+// echo state
+#define SYSEX_ECHO_OFF 0
+#define SYSEX_ECHO_ON 1
+#define SYSEX_ECHO_CUT 2  // a byte could not be queued - only the end is sent
+
+#define SYSEX_HEADER_LEN 4
+rom unsigned char *sysex_header = {0x00, 0x01, 0x72, 0x40};
 
 #define SYSEX_RX_MAX_LEN 64
 unsigned char sysex_rx_buf[SYSEX_RX_MAX_LEN];
 unsigned char sysex_rx_len;
+unsigned char sysex_rx_state;
+unsigned char sysex_echo;
+
+// chain discovery - learned from the replies of the units ahead of us
+unsigned char chain_hop;  // units ahead of us in the chain
+unsigned int chain_upstream;  // latency from the first unit to us - us
 
 // local functions
 void sysex_parse_system_config(void);
+void sysex_tx_rx_stats(void);
+void sysex_echo_flush(void);
 
 // init the sysex code
 void sysex_init(void) {
-	sysex_tx_len = 0;
 	sysex_rx_len = 0;
+	sysex_rx_state = SYSEX_STATE_IDLE;
+	sysex_echo = SYSEX_ECHO_OFF;
+	chain_hop = 0;
+	chain_upstream = 0;
 }
 
 // handle start of SYSEX packet
 void sysex_rx_start(void) {
 	sysex_rx_len = 0;
+	sysex_rx_state = SYSEX_STATE_HEADER;
+	// cut-through mode has forwarded it already - or it is filtered
+	sysex_echo = SYSEX_ECHO_OFF;
+	if(midi_thru_echo(MIDI_THRU_SYSEX, MIDI_THRU_NO_CHAN)) sysex_echo = SYSEX_ECHO_ON;
 }
 
 // handle SYSEX data byte
 void sysex_rx_data(unsigned char data_byte) {
-	// trying to send too many data bytes
-	if(sysex_rx_len >= SYSEX_RX_MAX_LEN) {
-		sysex_rx_len = 0;
+	// match the header one byte at a time - held back until we know it is not ours
+	if(sysex_rx_state == SYSEX_STATE_HEADER) {
+		sysex_rx_buf[sysex_rx_len] = data_byte;
+		sysex_rx_len ++;
+		if(data_byte != sysex_header[sysex_rx_len - 1]) {
+			sysex_rx_state = SYSEX_STATE_STREAM;
+			sysex_echo_flush();
+			return;
+		}
+		if(sysex_rx_len == SYSEX_HEADER_LEN) sysex_rx_state = SYSEX_STATE_CAPTURE;
+		return;
+	}
+	// capture our messages - too long means it is not one we know
+	if(sysex_rx_state == SYSEX_STATE_CAPTURE) {
+		if(sysex_rx_len < SYSEX_RX_MAX_LEN) {
+			sysex_rx_buf[sysex_rx_len] = data_byte;
+			sysex_rx_len ++;
+			return;
+		}
+		sysex_rx_state = SYSEX_STATE_STREAM;
+		sysex_echo_flush();
+	}
+	// pass other messages on as they arrive
+	if(sysex_echo == SYSEX_ECHO_ON) {
+		if(midi_tx_reserve(1, MIDI_TX_CLASS_NORMAL)) _midi_tx_sysex_data(data_byte);
+		else sysex_echo = SYSEX_ECHO_CUT;
 	}
-	sysex_rx_buf[sysex_rx_len] = data_byte;
-	sysex_rx_len ++;
 }
 
 // handle end of SYSEX packet
 void sysex_rx_end(void) {
 	unsigned char i;
-	unsigned char echo_msg = 1;  // default
-
-	// invalid message
-	if(sysex_rx_len == 0) return;
-
-	// can we parse it?
-	if(sysex_rx_len >= 5) {
-		// is this a Kilpatrick Audio K1600 message?
-		if(sysex_rx_buf[0] == 0x00 && 
-				sysex_rx_buf[1] == 0x01 &&
-				sysex_rx_buf[2] == 0x72 &&
-				sysex_rx_buf[3] == 0x40) {
-			// set system configuration
-			if(sysex_rx_buf[4] == SYSEX_CMD_SYSTEM_CONFIG && sysex_rx_len == 29) {
-				sysex_parse_system_config();
+	unsigned int val;
+
+	// echo a held back message whole - otherwise close the stream
+	// a cut message still gets its end so the receiver resyncs
+	if(sysex_rx_state == SYSEX_STATE_HEADER || sysex_rx_state == SYSEX_STATE_CAPTURE) {
+		if(sysex_echo == SYSEX_ECHO_ON && 
+				midi_tx_reserve(sysex_rx_len + 2, MIDI_TX_CLASS_NORMAL)) {
+			_midi_tx_sysex_start();
+			for(i = 0; i < sysex_rx_len; i ++) {
+				_midi_tx_sysex_data(sysex_rx_buf[i]);
 			}
+			_midi_tx_sysex_end();
 		}
 	}
+	else if(sysex_echo != SYSEX_ECHO_OFF && midi_tx_reserve(1, MIDI_TX_CLASS_NORMAL)) {
+		_midi_tx_sysex_end();
+	}
+	sysex_echo = SYSEX_ECHO_OFF;
 
-	// if we're allowed to echo this message
-	if(echo_msg) {
-		_midi_tx_sysex_start();
-		for(i = 0; i < sysex_rx_len; i ++) {
-			_midi_tx_sysex_data(sysex_rx_buf[i]);
+	// can we parse it? - only complete Kilpatrick Audio K1600 messages are captured
+	if(sysex_rx_state == SYSEX_STATE_CAPTURE && sysex_rx_len >= 5) {
+		// set system configuration
+		if(sysex_rx_buf[4] == SYSEX_CMD_SYSTEM_CONFIG && sysex_rx_len == 29) {
+			sysex_parse_system_config();
+		}
+		// read receive health counters - bit 0 set = clear after reading
+		else if(sysex_rx_buf[4] == SYSEX_CMD_RX_STATS && sysex_rx_len == 6) {
+			sysex_tx_rx_stats();
+			if(sysex_rx_buf[5] & 0x01) {
+				midi_clear_rx_stats();
+				midi_clear_tx_stats();
+			}
+		}
+		// set thru mode - 0 = echo, 1 = cut-through
+		else if(sysex_rx_buf[4] == SYSEX_CMD_THRU_MODE && sysex_rx_len == 6) {
+			event_set_thru_mode(sysex_rx_buf[5]);
+		}
+		// set thru filter - blocked channels 1-7, 8-14, 15-16 then blocked classes
+		else if(sysex_rx_buf[4] == SYSEX_CMD_THRU_FILTER && sysex_rx_len == 9) {
+			event_set_thru_filter(sysex_rx_buf[5] |
+				((unsigned int)sysex_rx_buf[6] << 7) |
+				((unsigned int)(sysex_rx_buf[7] & 0x03) << 14),
+				sysex_rx_buf[8]);
+		}
+		// chain ping - restart discovery and answer with our hop latency
+		else if(sysex_rx_buf[4] == SYSEX_CMD_CHAIN_PING && sysex_rx_len == 5) {
+			chain_hop = 0;
+			chain_upstream = 0;
+			val = midi_get_hop_latency();
+			sysex_tx_msg2(SYSEX_CMD_CHAIN_REPLY, (val >> 7) & 0x7f, val & 0x7f);
+		}
+		// chain reply from a unit ahead of us
+		else if(sysex_rx_buf[4] == SYSEX_CMD_CHAIN_REPLY && sysex_rx_len == 7) {
+			if(chain_hop < 127) chain_hop ++;
+			chain_upstream += ((unsigned int)sysex_rx_buf[5] << 7) | sysex_rx_buf[6];
+		}
+		// chain sync - delay our outputs to line up with the last unit
+		// bit 0 of the flags byte set = also take the hop position as the voice unit
+		else if(sysex_rx_buf[4] == SYSEX_CMD_CHAIN_SYNC && sysex_rx_len == 8) {
+			val = ((unsigned int)sysex_rx_buf[5] << 7) | sysex_rx_buf[6];
+			if(val > chain_upstream) val -= chain_upstream;
+			else val = 0;
+			event_set_output_delay((val + 128) >> 8);
+			if(sysex_rx_buf[7] & 0x01) voice_set_unit(chain_hop);
+		}
+		// set a trigger note - trig, note, flags
+		// flags bit 0 = note on / off, bit 1 = clear the other notes first
+		else if(sysex_rx_buf[4] == SYSEX_CMD_TRIG_NOTE && sysex_rx_len == 8) {
+			if(sysex_rx_buf[7] & 0x02) event_clear_trig_notes(sysex_rx_buf[5]);
+			event_set_trig_note(sysex_rx_buf[5], sysex_rx_buf[6], sysex_rx_buf[7] & 0x01);
+		}
+		// set a CV slew time - CV, time in 4ms steps - 0 = off - CC mappings only
+		else if(sysex_rx_buf[4] == SYSEX_CMD_CV_SLEW && sysex_rx_len == 7) {
+			event_set_cv_slew(sysex_rx_buf[5], sysex_rx_buf[6]);
+		}
+		// direct control - CV1 MSB, LSB, CV2 MSB, LSB, gates - CVs are 14 bit like CC pairs
+		else if(sysex_rx_buf[4] == SYSEX_CMD_DIRECT && sysex_rx_len == 10) {
+			event_set_direct(((unsigned int)sysex_rx_buf[5] << 5) | (sysex_rx_buf[6] >> 2),
+				((unsigned int)sysex_rx_buf[7] << 5) | (sysex_rx_buf[8] >> 2),
+				sysex_rx_buf[9]);
 		}
-		_midi_tx_sysex_end();
 	}
+
+	sysex_rx_state = SYSEX_STATE_IDLE;
 }
 
 // send a SYSEX packet with CMD and DATA
 void sysex_tx_msg(unsigned char cmd, unsigned char data) {
+	if(!midi_tx_reserve(8, MIDI_TX_CLASS_NORMAL)) return;
 	_midi_tx_sysex_start();
 	_midi_tx_sysex_data(0x00);
 	_midi_tx_sysex_data(0x01);
@@ -90,6 +194,7 @@ void sysex_tx_msg(unsigned char cmd, unsigned char data) {
 
 // send a SYSEX packet with CMD and 2 DATA bytes
 void sysex_tx_msg2(unsigned char cmd, unsigned char data0, unsigned char data1) {
+	if(!midi_tx_reserve(9, MIDI_TX_CLASS_NORMAL)) return;
 	_midi_tx_sysex_start();
 	_midi_tx_sysex_data(0x00);
 	_midi_tx_sysex_data(0x01);
@@ -145,3 +250,48 @@ void sysex_parse_system_config(void) {
 	voice_set_pitch_bend_range(0, sysex_rx_buf[5 + 0x16]);
 	voice_set_pitch_bend_range(1, sysex_rx_buf[5 + 0x17]);
 }
+
+// send the receive health counters, TX rate and TX drop counters - 2 bytes each, MSB first
+// then the RX queue depth before and after the last drain - 1 byte each
+void sysex_tx_rx_stats(void) {
+	unsigned char i;
+	unsigned int val;
+	if(!midi_tx_reserve(9 + (MIDI_RX_STATS + 1 + MIDI_TX_STATS) * 2, MIDI_TX_CLASS_NORMAL)) return;
+	_midi_tx_sysex_start();
+	_midi_tx_sysex_data(0x00);
+	_midi_tx_sysex_data(0x01);
+	_midi_tx_sysex_data(0x72);
+	_midi_tx_sysex_data(0x40);
+	_midi_tx_sysex_data(SYSEX_CMD_RX_STATS);
+	for(i = 0; i < MIDI_RX_STATS; i ++) {
+		val = midi_get_rx_stat(i);
+		_midi_tx_sysex_data((val >> 7) & 0x7f);
+		_midi_tx_sysex_data(val & 0x7f);
+	}
+	val = midi_get_tx_rate();
+	_midi_tx_sysex_data((val >> 7) & 0x7f);
+	_midi_tx_sysex_data(val & 0x7f);
+	for(i = 0; i < MIDI_TX_STATS; i ++) {
+		val = midi_get_tx_stat(i);
+		_midi_tx_sysex_data((val >> 7) & 0x7f);
+		_midi_tx_sysex_data(val & 0x7f);
+	}
+	// RX queue depth before and after the last drain - always under 128
+	_midi_tx_sysex_data(midi_get_rx_depth_pre() & 0x7f);
+	_midi_tx_sysex_data(midi_get_rx_depth_post() & 0x7f);
+	_midi_tx_sysex_end();
+}
+
+// start streaming a message that was held back for the header match
+void sysex_echo_flush(void) {
+	unsigned char i;
+	if(sysex_echo != SYSEX_ECHO_ON) return;
+	if(!midi_tx_reserve(sysex_rx_len + 1, MIDI_TX_CLASS_NORMAL)) {
+		sysex_echo = SYSEX_ECHO_OFF;  // nothing sent yet so nothing to close
+		return;
+	}
+	_midi_tx_sysex_start();
+	for(i = 0; i < sysex_rx_len; i ++) {
+		_midi_tx_sysex_data(sysex_rx_buf[i]);
+	}
+}
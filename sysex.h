@@ -7,6 +7,15 @@
  *
  */
 #define SYSEX_CMD_SYSTEM_CONFIG 0x02
+#define SYSEX_CMD_RX_STATS 0x03
+#define SYSEX_CMD_THRU_MODE 0x04
+#define SYSEX_CMD_THRU_FILTER 0x05
+#define SYSEX_CMD_CHAIN_PING 0x06
+#define SYSEX_CMD_CHAIN_REPLY 0x07
+#define SYSEX_CMD_CHAIN_SYNC 0x08
+#define SYSEX_CMD_TRIG_NOTE 0x09
+#define SYSEX_CMD_CV_SLEW 0x0a
+#define SYSEX_CMD_DIRECT 0x0b
 #define SYSEX_CMD_EEPROM_READ 0x70
 #define SYSEX_CMD_EEPROM_WRITE 0x71
 